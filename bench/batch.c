@@ -0,0 +1,104 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file batch.c
+ * \date Oct 17, 2026
+ *
+ * Benchmark for \c ak_malloc_batch() and \c ak_free_batch() against the same number of single
+ * \c ak_malloc() and \c ak_free() calls, on one thread. The thread cache is off unless
+ * <tt>-DAKMALLOC_THREAD_CACHE=1</tt> is given, so the single calls take the allocator lock every
+ * time. Build and run (POSIX only):
+ *
+ *     cc -O2 -DAKMALLOC_INCLUDE_ONLY -Iinclude bench/batch.c -o batch -lpthread
+ *     ./batch [objects per size and batch length]
+ *
+ * Each line gives the time per object of allocating a batch and freeing it again, with single
+ * calls and with the batch calls.
+ */
+
+#if !defined(AKMALLOC_THREAD_CACHE)
+#  define AKMALLOC_THREAD_CACHE 0
+#endif
+
+#include "akmalloc/malloc.c"
+
+#include "bench_common.h"
+
+#define BATCH_MAX 10000
+
+static void* BATCH_PTRS[BATCH_MAX];
+
+static double batch_singles(size_t sz, size_t n, long total)
+{
+    const double start = bench_now();
+    for (long done = 0; done < total; done += (long)n) {
+        for (size_t i = 0; i < n; ++i) {
+            BATCH_PTRS[i] = ak_malloc(sz);
+            *(char*)BATCH_PTRS[i] = (char)i;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            ak_free(BATCH_PTRS[i]);
+        }
+    }
+    return (bench_now() - start) * 1e9 / (double)total;
+}
+
+static double batch_batched(size_t sz, size_t n, long total)
+{
+    const double start = bench_now();
+    for (long done = 0; done < total; done += (long)n) {
+        if (ak_malloc_batch(sz, n, BATCH_PTRS) != n) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            *(char*)BATCH_PTRS[i] = (char)i;
+        }
+        ak_free_batch(BATCH_PTRS, n);
+    }
+    return (bench_now() - start) * 1e9 / (double)total;
+}
+
+int main(int argc, char** argv)
+{
+    static const size_t sizes[] = { 16, 32, 128, 256, 1024 };
+    static const size_t lengths[] = { 16, 64, 1024, BATCH_MAX };
+    const long total = (argc > 1) ? atol(argv[1]) : 4000000;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+            // warm up, so that both runs find the pages already mapped
+            batch_singles(sizes[s], lengths[l], (long)lengths[l]);
+            const double single = batch_singles(sizes[s], lengths[l], total);
+            const double batched = batch_batched(sizes[s], lengths[l], total);
+            printf("%5zu B  batch %5zu  single %6.1f ns/object  batch %6.1f ns/object\n",
+                   sizes[s], lengths[l], single, batched);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
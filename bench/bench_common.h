@@ -0,0 +1,146 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file bench_common.h
+ * \date Oct 17, 2026
+ *
+ * Harness shared by the benchmarks: a monotonic clock, a random size generator, and starting a
+ * number of threads that all begin at once. Include it after akmalloc/malloc.c (POSIX only).
+ */
+
+#ifndef AKMALLOC_BENCH_COMMON_H
+#define AKMALLOC_BENCH_COMMON_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_BATCH       16
+
+typedef struct bench_thread_tag bench_thread;
+
+typedef void* (*bench_worker_fn)(void*);
+
+struct bench_thread_tag
+{
+    pthread_t thread;
+    unsigned  seed;
+    long      ops;
+    size_t    sz;   /**< fixed request size, or \c 0 for sizes from bench_mixed_size() */
+};
+
+static volatile int BENCH_GO = 0;
+
+static inline double bench_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + ((double)t.tv_nsec * 1e-9);
+}
+
+static inline unsigned bench_rand(unsigned* seed)
+{
+    *seed = (*seed * 1103515245u) + 12345u;
+    return *seed >> 8;
+}
+
+/*!
+ * A request size, mostly small sizes and one in eight up to 64KB.
+ */
+static inline size_t bench_mixed_size(unsigned* seed)
+{
+    const unsigned r = bench_rand(seed);
+    return ((r & 7) == 0) ? (16 + (r >> 3) % 65536) : (16 + (r >> 3) % 512);
+}
+
+/*!
+ * The request size of the next allocation of a thread.
+ */
+static inline size_t bench_size(bench_thread* bt)
+{
+    return bt->sz ? bt->sz : bench_mixed_size(&(bt->seed));
+}
+
+/*!
+ * Wait until bench_run() lets all threads go. Call first in a worker.
+ */
+static inline void bench_wait_start(void)
+{
+    while (!BENCH_GO) {
+        sched_yield();
+    }
+}
+
+/*!
+ * Start \p nthreads threads running \p fn on their entry of \p bt, release them at once, and wait
+ * for all of them.
+ *
+ * \return The time in seconds from the release to the last thread finishing.
+ */
+static inline double bench_run(bench_thread* bt, int nthreads, bench_worker_fn fn)
+{
+    BENCH_GO = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        if (pthread_create(&(bt[i].thread), NULL, fn, &(bt[i])) != 0) {
+            fprintf(stderr, "could not start thread %d\n", i);
+            exit(1);
+        }
+    }
+    const double start = bench_now();
+    BENCH_GO = 1;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(bt[i].thread, NULL);
+    }
+    return bench_now() - start;
+}
+
+/*!
+ * Allocate and free \c BENCH_BATCH objects at a time through \c ak_malloc() and \c ak_free()
+ * until \p bt->ops pairs are done.
+ */
+static inline void* bench_malloc_free_worker(void* arg)
+{
+    bench_thread* bt = (bench_thread*)arg;
+    void* p[BENCH_BATCH];
+    bench_wait_start();
+    for (long i = 0; i < bt->ops; i += BENCH_BATCH) {
+        for (int j = 0; j < BENCH_BATCH; ++j) {
+            p[j] = ak_malloc(bench_size(bt));
+            *(char*)p[j] = (char)j;
+        }
+        for (int j = 0; j < BENCH_BATCH; ++j) {
+            ak_free(p[j]);
+        }
+    }
+    return NULL;
+}
+
+#endif/*AKMALLOC_BENCH_COMMON_H*/
@@ -0,0 +1,81 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file class_scaling.c
+ * \date Oct 17, 2026
+ *
+ * Scaling benchmark for threads that allocate from different size classes of the same malloc
+ * state. Thread \c i allocates and frees objects of <tt>16 * (i % 16 + 1)</tt> bytes through
+ * \c ak_malloc() and \c ak_free() without a thread cache, so every thread takes the lock of its
+ * own slab root and threads only slow each other down through the cache lines the roots share.
+ * Build and run (POSIX only):
+ *
+ *     cc -O2 -DAKMALLOC_INCLUDE_ONLY -Iinclude bench/class_scaling.c -o class_scaling -lpthread
+ *     ./class_scaling [max threads] [ops per thread]
+ *
+ * Each line gives the pairs of malloc/free completed per second by all threads, and the speedup
+ * over one thread. With no false sharing between the roots the speedup follows the number of
+ * threads up to the number of cores.
+ */
+
+#if !defined(AKMALLOC_THREAD_CACHE)
+#  define AKMALLOC_THREAD_CACHE 0
+#endif
+
+#include "akmalloc/malloc.c"
+
+#include "bench_common.h"
+
+#define BENCH_CLASSES 16
+
+static double class_scaling_run(int nthreads, long ops)
+{
+    bench_thread bt[BENCH_MAX_THREADS];
+    for (int i = 0; i < nthreads; ++i) {
+        bt[i].seed = 12345u + (unsigned)i;
+        bt[i].ops = ops;
+        bt[i].sz = (size_t)16 * ((i % BENCH_CLASSES) + 1);
+    }
+    const double secs = bench_run(bt, nthreads, bench_malloc_free_worker);
+    return ((double)ops * nthreads) / secs * 1e-6;
+}
+
+int main(int argc, char** argv)
+{
+    int maxthreads = (argc > 1) ? atoi(argv[1]) : BENCH_CLASSES;
+    const long ops = (argc > 2) ? atol(argv[2]) : 1000000;
+    maxthreads = (maxthreads > BENCH_MAX_THREADS) ? BENCH_MAX_THREADS : maxthreads;
+    double base = 0.0;
+    for (int n = 1; n <= maxthreads; n *= 2) {
+        const double mops = class_scaling_run(n, ops);
+        base = (n == 1) ? mops : base;
+        printf("%3d threads  %8.2f Mops/s  %5.2fx\n", n, mops, mops / base);
+        fflush(stdout);
+    }
+    return 0;
+}
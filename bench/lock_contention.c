@@ -0,0 +1,82 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file lock_contention.c
+ * \date Oct 17, 2026
+ *
+ * Contention benchmark for the allocator lock policies. Threads allocate and free through
+ * \c ak_malloc() and \c ak_free() without a thread cache, so that every call takes the lock of a
+ * shared slab or coalescing root. The lock policy is chosen at compile time, build once per
+ * policy (POSIX only):
+ *
+ *     for p in 0 1 2 3; do
+ *         cc -O2 -DAKMALLOC_INCLUDE_ONLY -DAKMALLOC_LOCK_POLICY=$p -Iinclude \
+ *            bench/lock_contention.c -o lock_contention_$p -lpthread
+ *     done
+ *     ./lock_contention_0 [ops per thread]
+ *
+ * For every thread count from 1 to 64 two workloads are run: all threads on one slab size, and
+ * sizes spread over the slabs and the coalescing allocators. Each line gives the time of one
+ * malloc/free pair as seen by a thread, and the pairs completed per second by all threads.
+ */
+
+#if !defined(AKMALLOC_THREAD_CACHE)
+#  define AKMALLOC_THREAD_CACHE 0
+#endif
+
+#include "akmalloc/malloc.c"
+
+#include "bench_common.h"
+
+static const char* const POLICY_NAMES[] = { "spin", "futex", "ticket", "mcs" };
+
+static void lock_contention_run(int nthreads, int mixed, long ops)
+{
+    bench_thread bt[BENCH_MAX_THREADS];
+    for (int i = 0; i < nthreads; ++i) {
+        bt[i].seed = 12345u + (unsigned)i;
+        bt[i].ops = ops;
+        bt[i].sz = mixed ? 0 : 64;
+    }
+    const double secs = bench_run(bt, nthreads, bench_malloc_free_worker);
+    printf("%-6s  %-5s  %3d threads  %9.1f ns/op  %8.2f Mops/s\n",
+           POLICY_NAMES[AKMALLOC_LOCK_POLICY], mixed ? "mixed" : "one",
+           nthreads, (secs * 1e9 * nthreads) / ops, ((double)ops * nthreads) / secs * 1e-6);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    const long ops = (argc > 1) ? atol(argv[1]) : 200000;
+    for (int mixed = 0; mixed < 2; ++mixed) {
+        for (int n = 1; n <= BENCH_MAX_THREADS; n *= 2) {
+            lock_contention_run(n, mixed, ops);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_colour.c
+ * \date Oct 17, 2026
+ *
+ * Cache benchmark for slab colouring. Objects come straight from a slab root and are linked into
+ * a list in shuffled order, which is then walked with one load per node. Taking only the first
+ * object of every slab puts all nodes at the same page offset when slabs are not coloured, so
+ * they compete for a few cache sets. The span classes are also walked over all their objects.
+ * Build once with the default colouring and once without, and compare (POSIX only):
+ *
+ *     cc -O2 -DNDEBUG -DAKMALLOC_INCLUDE_ONLY -Iinclude bench/slab_colour.c -o slab_colour
+ *     cc -O2 -DNDEBUG -DAKMALLOC_INCLUDE_ONLY -DAK_SLAB_COLOUR_STEP=0 -Iinclude \
+ *        bench/slab_colour.c -o slab_colour_off
+ *     ./slab_colour [steps]
+ *
+ * Each line gives the time per node of the walk.
+ */
+
+#include "akmalloc/malloc.c"
+
+#include "bench_common.h"
+
+typedef struct colour_node_tag colour_node;
+
+struct colour_node_tag
+{
+    colour_node* next;
+    long v;
+};
+
+static unsigned COLOUR_SEED = 99;
+
+/* keeps the compiler from dropping the walk */
+static volatile long COLOUR_SINK = 0;
+
+static void slab_colour_run(ak_slab_root* r, const char* name, int nslabs, int firstonly, long steps)
+{
+    const int total = nslabs * (int)r->navail;
+    void** objs = (void**)malloc(sizeof(void*) * total);
+    colour_node** nodes = (colour_node**)malloc(sizeof(colour_node*) * total);
+    int n = 0;
+    for (int i = 0; i < total; ++i) {
+        objs[i] = ak_slab_alloc(r);
+        if (!firstonly || (i % (int)r->navail) == 0) {
+            nodes[n++] = (colour_node*)objs[i];
+        }
+    }
+    for (int i = n - 1; i > 0; --i) {
+        const int j = (int)(bench_rand(&COLOUR_SEED) % (unsigned)(i + 1));
+        colour_node* t = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = t;
+    }
+    for (int i = 0; i < n; ++i) {
+        nodes[i]->next = nodes[(i + 1) % n];
+        nodes[i]->v = i;
+    }
+
+    colour_node* p = nodes[0];
+    long sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += p->v;
+        p = p->next;
+    }
+    const double start = bench_now();
+    for (long i = 0; i < steps; ++i) {
+        sum += p->v;
+        p = p->next;
+    }
+    const double ns = (bench_now() - start) * 1e9 / (double)steps;
+    COLOUR_SINK = sum;
+    printf("%-5s %-9s %6d nodes  %6.2f ns/node\n", name, firstonly ? "1st/slab" : "all", n, ns);
+    fflush(stdout);
+
+    for (int i = 0; i < total; ++i) {
+        ak_slab_free(objs[i]);
+    }
+    free(objs);
+    free(nodes);
+}
+
+int main(int argc, char** argv)
+{
+    const long steps = (argc > 1) ? atol(argv[1]) : 50000000;
+    ak_slab_root r;
+    printf("AK_SLAB_COLOUR_STEP %d\n", (int)AK_SLAB_COLOUR_STEP);
+
+    ak_slab_init_root_default(&r, 256);
+    slab_colour_run(&r, "256", 1024, 1, steps);
+    slab_colour_run(&r, "256", 2048, 1, steps);
+    ak_slab_init_root_default(&r, 160);
+    slab_colour_run(&r, "160", 1024, 1, steps);
+    ak_slab_init_root_span(&r, 1024);
+    slab_colour_run(&r, "1KB", 512, 1, steps);
+    slab_colour_run(&r, "1KB", 64, 0, steps);
+    ak_slab_init_root_span(&r, 2048);
+    slab_colour_run(&r, "2KB", 64, 0, steps);
+    ak_slab_init_root_span(&r, 4096);
+    slab_colour_run(&r, "4KB", 64, 0, steps);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_footprint.c
+ * \date Oct 17, 2026
+ *
+ * Footprint of small objects of sizes that are odd multiples of 8 bytes. 200000 objects of each
+ * size are allocated and kept, and the growth of the resident set is printed for every size and
+ * in total. Compare a default build, where slab sizes up to 128 bytes are 8 bytes apart, with one
+ * where they are 16 bytes apart (Linux only):
+ *
+ *     cc -O2 -DAKMALLOC_INCLUDE_ONLY -Iinclude bench/slab_footprint.c -o slab_footprint
+ *     cc -O2 -DAKMALLOC_INCLUDE_ONLY -DAK_MIN_SLAB_ALIGN_16 -Iinclude bench/slab_footprint.c \
+ *        -o slab_footprint_16
+ */
+
+#include "akmalloc/malloc.c"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define FOOTPRINT_OBJECTS 200000
+
+/*!
+ * The resident set size of the process in KB.
+ */
+static long footprint_rss_kb(void)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f || (fscanf(f, "%ld %ld", &pages, &resident) != 2)) {
+        fprintf(stderr, "could not read /proc/self/statm\n");
+        return 0;
+    }
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 8, 24, 40, 56, 72, 104 };
+    // initialize the allocator before the first measurement
+    ak_free(ak_malloc(1));
+    const long start = footprint_rss_kb();
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const long before = footprint_rss_kb();
+        for (int i = 0; i < FOOTPRINT_OBJECTS; ++i) {
+            char* p = (char*)ak_malloc(sizes[s]);
+            p[0] = (char)i;
+        }
+        printf("%4zu B: %6ld KB\n", sizes[s], footprint_rss_kb() - before);
+    }
+    printf("total:  %6ld KB\n", footprint_rss_kb() - start);
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_search.c
+ * \date Oct 17, 2026
+ *
+ * Microbenchmark for finding a free object in the bitmap of a slab page (\c ak_slab_search), with
+ * no locks or page lists involved. The first part searches a page whose only free object is at a
+ * given index. The second part takes every object of a full page of 8 byte objects in turn.
+ * Build with \c NDEBUG, the assertions in the search otherwise cost more than the search:
+ *
+ *     cc -O2 -DNDEBUG -DAKMALLOC_INCLUDE_ONLY -Iinclude bench/slab_search.c -o slab_search
+ *     ./slab_search [iterations]
+ */
+
+#include "akmalloc/malloc.c"
+
+#include "bench_common.h"
+
+#define SEARCH_NAVAIL 496
+
+static union
+{
+    ak_slab s;
+    char    page[AKMALLOC_DEFAULT_PAGE_SIZE];
+} SEARCH_PAGE;
+
+/* keeps the compiler from dropping the searches */
+static volatile ak_sz SEARCH_SINK = 0;
+
+int main(int argc, char** argv)
+{
+    static const int positions[] = { 0, 100, 300, 495 };
+    const long iters = (argc > 1) ? atol(argv[1]) : 50000000;
+    ak_slab* s = &(SEARCH_PAGE.s);
+    s->colour = 0;
+
+    for (size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); ++p) {
+        ak_bitset512_clear_all(&(s->avail));
+        ak_sz sum = 0;
+        const double start = bench_now();
+        for (long i = 0; i < iters; ++i) {
+            ak_bitset512_set(&(s->avail), positions[p]);
+            s->nfree = 1;
+            sum += (ak_sz)ak_slab_search(s, 8);
+        }
+        const double ns = (bench_now() - start) * 1e9 / (double)iters;
+        SEARCH_SINK = sum;
+        printf("free object at %3d: %5.2f ns/search\n", positions[p], ns);
+    }
+
+    const long pages = iters / SEARCH_NAVAIL;
+    ak_sz sum = 0;
+    const double start = bench_now();
+    for (long i = 0; i < pages; ++i) {
+        ak_bitset512_set_first_n(&(s->avail), SEARCH_NAVAIL);
+        s->nfree = SEARCH_NAVAIL;
+        for (int j = 0; j < SEARCH_NAVAIL; ++j) {
+            sum += (ak_sz)ak_slab_search(s, 8);
+        }
+    }
+    const double ns = (bench_now() - start) * 1e9 / (double)(pages * SEARCH_NAVAIL);
+    SEARCH_SINK = sum;
+    printf("whole page of %d:    %5.2f ns/search\n", SEARCH_NAVAIL, ns);
+    return 0;
+}
@@ -218,6 +218,7 @@ For more information, please refer to <http://unlicense.org/>
 #  endif
 #endif
 
+typedef unsigned short ak_u16;
 typedef int ak_i32;
 typedef unsigned int ak_u32;
 
@@ -256,6 +257,12 @@ typedef ak_i64 ak_ssz;
 #  define ak_unlikely(x) __builtin_expect(!!(x), 0)
 #endif/*AKMALLOC_MSVC*/
 
+#if AKMALLOC_MSVC
+#  define ak_thread_local __declspec(thread)
+#else
+#  define ak_thread_local __thread __attribute__((tls_model("initial-exec")))
+#endif/*AKMALLOC_MSVC*/
+
 #define AK_SZ_ONE ((ak_sz)1)
 
 #define AK_SZ_MAX (~((ak_sz)0))
@@ -275,6 +282,13 @@ typedef ak_i64 ak_ssz;
 #  define AKMALLOC_CACHE_LINE_LENGTH 64
 #endif
 
+/* starts a structure member on a new cache line, and pads the structure to whole cache lines */
+#if AKMALLOC_MSVC
+#  define AK_CACHE_ALIGNED __declspec(align(AKMALLOC_CACHE_LINE_LENGTH))
+#else
+#  define AK_CACHE_ALIGNED __attribute__((aligned(AKMALLOC_CACHE_LINE_LENGTH)))
+#endif
+
 #define ak_as_ptr(x) (&(x))
 
 #define ak_ptr_cast(ty, expr) ((ty*)((void*)(expr)))
@@ -320,6 +334,12 @@ typedef ak_i64 ak_ssz;
 /********************** assert end ************************/
 
 /********************** spinlock begin ************************/
+#if AKMALLOC_WINDOWS
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <Windows.h>
+#endif
+
 typedef struct ak_spinlock_tag ak_spinlock;
 
 struct ak_spinlock_tag
@@ -334,6 +354,24 @@ static void ak_spinlock_yield();
 #if !AKMALLOC_MSVC && (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) > 40100
 #  define ak_atomic_cas(px, nx, ox) __sync_bool_compare_and_swap((px), (ox), (nx))
 #  define ak_atomic_xchg(px, nx) __sync_lock_test_and_set((px), (nx))
+#  define ak_atomic_cas64(px, nx, ox) __sync_bool_compare_and_swap((px), (ox), (nx))
+#  define ak_atomic_cas_ptr(px, nx, ox) __sync_bool_compare_and_swap((px), (ox), (nx))
+#  define ak_atomic_xchg_ptr(px, nx) __sync_lock_test_and_set((px), (nx))
+#  define ak_atomic_fetch_add(px, v) __sync_fetch_and_add((px), (v))
+#  define ak_atomic_fetch_add_sz(px, v) __sync_fetch_and_add((px), (v))
+#  define ak_atomic_fence() __sync_synchronize()
+#  if (__GNUC__ * 100 + __GNUC_MINOR__) >= 407
+#    define ak_atomic_store_release(px, v) __atomic_store_n((px), (v), __ATOMIC_RELEASE)
+#  else
+#    define ak_atomic_store_release(px, v) do { __sync_synchronize(); *(px) = (v); } while (0)
+#  endif
+#  if defined(__i386__) || defined(__x86_64__)
+#    define ak_cpu_relax() __builtin_ia32_pause()
+#  elif defined(__aarch64__) || defined(__arm__)
+#    define ak_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#  else
+#    define ak_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#  endif
 #else/* Windows */
 #  ifndef _M_AMD64
    /* These are already defined on AMD64 builds */
@@ -345,6 +383,19 @@ static void ak_spinlock_yield();
 #  endif /* _M_AMD64 */
 #  define ak_atomic_cas(px, nx, ox) (_InterlockedCompareExchange((volatile long*)(px), (nx), (ox)) == (ox))
 #  define ak_atomic_xchg(px, nx) _InterlockedExchange((volatile long*)(px), (nx))
+#  define ak_atomic_cas64(px, nx, ox) (_InterlockedCompareExchange64((volatile __int64*)(px), (__int64)(nx), (__int64)(ox)) == (__int64)(ox))
+#  define ak_atomic_cas_ptr(px, nx, ox) (_InterlockedCompareExchangePointer((void* volatile*)(px), (void*)(nx), (void*)(ox)) == (void*)(ox))
+#  define ak_atomic_xchg_ptr(px, nx) _InterlockedExchangePointer((void* volatile*)(px), (void*)(nx))
+#  define ak_atomic_fetch_add(px, v) _InterlockedExchangeAdd((volatile long*)(px), (v))
+#  if defined(_WIN64)
+#    define ak_atomic_fetch_add_sz(px, v) _InterlockedExchangeAdd64((volatile __int64*)(px), (__int64)(v))
+#  else
+#    define ak_atomic_fetch_add_sz(px, v) _InterlockedExchangeAdd((volatile long*)(px), (long)(v))
+#  endif
+#  define ak_atomic_fence() MemoryBarrier()
+   /* plain volatile stores have release semantics with MSVC (/volatile:ms) */
+#  define ak_atomic_store_release(px, v) do { _ReadWriteBarrier(); *(px) = (v); } while (0)
+#  define ak_cpu_relax() YieldProcessor()
 #endif/* Windows */
 
 ak_inline static int ak_spinlock_is_locked(ak_spinlock* p)
@@ -369,14 +420,17 @@ ak_inline static void ak_spinlock_acquire(ak_spinlock* p)
 #  define SPINS_PER_YIELD 31
 #endif
 
-    if (ak_atomic_xchg(&(p->islocked), 1)) {
-        while (ak_atomic_xchg(&(p->islocked), 1)) {
+    while (ak_atomic_xchg(&(p->islocked), 1)) {
+        // wait on a plain read so that the cache line is shared while the lock is held
+        while (ak_spinlock_is_locked(p)) {
             if ((++spins & SPINS_PER_YIELD) == 0) {
 #if AKMALLOC_MACOS || AKMALLOC_IOS
                 ak_os_sleep(40);
 #else
                 ak_spinlock_yield();
 #endif
+            } else {
+                ak_cpu_relax();
             }
         }
     }
@@ -386,18 +440,19 @@ ak_inline static void ak_spinlock_acquire(ak_spinlock* p)
     AKMALLOC_ASSERT(ak_spinlock_is_locked(p));
 }
 
+ak_inline static int ak_spinlock_try_acquire(ak_spinlock* p)
+{
+    return !ak_spinlock_is_locked(p) && !ak_atomic_xchg(&(p->islocked), 1);
+}
+
 ak_inline static void ak_spinlock_release(ak_spinlock* p)
 {
     AKMALLOC_ASSERT(ak_spinlock_is_locked(p));
-    ak_atomic_xchg(&(p->islocked), 0);
+    ak_atomic_store_release(&(p->islocked), 0);
 }
 
 #if AKMALLOC_WINDOWS
 
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
-
 static void ak_os_sleep(ak_u32 micros)
 {
     SleepEx(micros / 1000, FALSE);
@@ -426,6 +481,435 @@ static void ak_spinlock_yield()
 #endif
 /********************** spinlock end ************************/
 
+/********************** threads begin ************************/
+/*
+ * Thread exit notification, processor count and helper threads
+ */
+#if AKMALLOC_WINDOWS
+
+typedef DWORD ak_thread_key;
+
+#  define AK_THREAD_EXIT_CALLBACK WINAPI
+
+typedef void (WINAPI *ak_thread_exit_cbk)(void*);
+
+ak_inline static int ak_thread_key_create(ak_thread_key* key, ak_thread_exit_cbk cbk)
+{
+    *key = FlsAlloc(cbk);
+    return *key != FLS_OUT_OF_INDEXES;
+}
+
+ak_inline static void ak_thread_key_set(ak_thread_key key, void* v)
+{
+    FlsSetValue(key, v);
+}
+
+typedef HANDLE ak_thread;
+
+#  define AK_THREAD_ROUTINE(nm) static DWORD WINAPI nm(LPVOID arg)
+#  define AK_THREAD_ROUTINE_RETURN return 0
+
+ak_inline static int ak_thread_start(ak_thread* t, LPTHREAD_START_ROUTINE fn, void* arg)
+{
+    *t = CreateThread(AK_NULLPTR, 0, fn, arg, 0, AK_NULLPTR);
+    return *t != AK_NULLPTR;
+}
+
+ak_inline static void ak_thread_join(ak_thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_key_t ak_thread_key;
+
+#  define AK_THREAD_EXIT_CALLBACK
+
+typedef void (*ak_thread_exit_cbk)(void*);
+
+ak_inline static int ak_thread_key_create(ak_thread_key* key, ak_thread_exit_cbk cbk)
+{
+    return pthread_key_create(key, cbk) == 0;
+}
+
+ak_inline static void ak_thread_key_set(ak_thread_key key, void* v)
+{
+    pthread_setspecific(key, v);
+}
+
+typedef pthread_t ak_thread;
+
+#  define AK_THREAD_ROUTINE(nm) static void* nm(void* arg)
+#  define AK_THREAD_ROUTINE_RETURN return AK_NULLPTR
+
+ak_inline static int ak_thread_start(ak_thread* t, void* (*fn)(void*), void* arg)
+{
+    return pthread_create(t, AK_NULLPTR, fn, arg) == 0;
+}
+
+ak_inline static void ak_thread_join(ak_thread t)
+{
+    pthread_join(t, AK_NULLPTR);
+}
+
+#endif
+/********************** threads end ************************/
+
+/********************** lock begin ************************/
+/*
+ * Locks for the allocators, selected with AKMALLOC_LOCK_POLICY:
+ *  - AK_LOCK_POLICY_SPIN:   test and test-and-set spinlock that yields every so often (ak_spinlock)
+ *  - AK_LOCK_POLICY_FUTEX:  spins for a while, then sleeps in the kernel (Linux only)
+ *  - AK_LOCK_POLICY_TICKET: FIFO ticket lock
+ *  - AK_LOCK_POLICY_MCS:    FIFO queue lock where every waiter spins on its own cache line
+ *
+ * The FIFO locks hand the lock to the next waiter in line even if it is not running. On Linux
+ * their waiters sleep in the kernel after AK_LOCK_SPINS_BEFORE_WAIT spins, like the futex lock,
+ * and a release wakes only the next waiter. With more threads than cores every hand over still
+ * waits for the next waiter to be scheduled, so they are much slower than SPIN and FUTEX there.
+ * Elsewhere they only yield, and they collapse when there are more threads than cores. Use them
+ * when threads do not outnumber cores.
+ */
+#define AK_LOCK_POLICY_SPIN   0
+#define AK_LOCK_POLICY_FUTEX  1
+#define AK_LOCK_POLICY_TICKET 2
+#define AK_LOCK_POLICY_MCS    3
+
+#if !defined(AKMALLOC_LOCK_POLICY)
+#  define AKMALLOC_LOCK_POLICY AK_LOCK_POLICY_SPIN
+#endif
+
+#if !defined(AK_LOCK_SPINS_BEFORE_WAIT)
+#  define AK_LOCK_SPINS_BEFORE_WAIT 100
+#endif
+
+#if AKMALLOC_LINUX && (AKMALLOC_LOCK_POLICY != AK_LOCK_POLICY_SPIN)
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#  define AK_LOCK_PARK
+
+ak_inline static void ak_futex_wait(ak_u32* p, ak_u32 v)
+{
+    syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, v, AK_NULLPTR, AK_NULLPTR, 0);
+}
+
+ak_inline static void ak_futex_wake(ak_u32* p, int n)
+{
+    syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, n, AK_NULLPTR, AK_NULLPTR, 0);
+}
+
+/* sleep and wake with a mask, a wake only reaches sleepers whose mask shares a bit with it */
+ak_inline static void ak_futex_wait_mask(ak_u32* p, ak_u32 v, ak_u32 mask)
+{
+    syscall(SYS_futex, p, FUTEX_WAIT_BITSET_PRIVATE, v, AK_NULLPTR, AK_NULLPTR, mask);
+}
+
+ak_inline static void ak_futex_wake_mask(ak_u32* p, ak_u32 mask)
+{
+    syscall(SYS_futex, p, FUTEX_WAKE_BITSET_PRIVATE, (int)(AK_U32_MAX >> 1), AK_NULLPTR, AK_NULLPTR, mask);
+}
+
+#endif
+
+#if AKMALLOC_LOCK_POLICY == AK_LOCK_POLICY_SPIN
+
+typedef ak_spinlock ak_lock;
+
+#  define ak_lock_init(p)        ak_spinlock_init(p)
+#  define ak_lock_acquire(p)     ak_spinlock_acquire(p)
+#  define ak_lock_try_acquire(p) ak_spinlock_try_acquire(p)
+#  define ak_lock_release(p)     ak_spinlock_release(p)
+
+#elif AKMALLOC_LOCK_POLICY == AK_LOCK_POLICY_FUTEX
+
+#if !AKMALLOC_LINUX
+#  error "AK_LOCK_POLICY_FUTEX is only supported on Linux."
+#endif
+
+typedef struct ak_lock_tag ak_lock;
+
+/* 0: unlocked, 1: locked, 2: locked with (possible) sleepers */
+struct ak_lock_tag
+{
+    ak_u32 state;
+};
+
+ak_inline static void ak_lock_init(ak_lock* p)
+{
+    p->state = 0;
+}
+
+static void ak_lock_acquire_slow(ak_lock* p)
+{
+    for (int i = 0; i < AK_LOCK_SPINS_BEFORE_WAIT; ++i) {
+        ak_cpu_relax();
+        if (*(volatile ak_u32*)(&(p->state)) == 0 && ak_atomic_cas(&(p->state), 1, 0)) {
+            return;
+        }
+    }
+    while (ak_atomic_xchg(&(p->state), 2) != 0) {
+        ak_futex_wait(&(p->state), 2);
+    }
+}
+
+ak_inline static void ak_lock_acquire(ak_lock* p)
+{
+    if (ak_unlikely(!ak_atomic_cas(&(p->state), 1, 0))) {
+        ak_lock_acquire_slow(p);
+    }
+}
+
+ak_inline static int ak_lock_try_acquire(ak_lock* p)
+{
+    return ak_atomic_cas(&(p->state), 1, 0);
+}
+
+ak_inline static void ak_lock_release(ak_lock* p)
+{
+    AKMALLOC_ASSERT(p->state != 0);
+    if (ak_unlikely(ak_atomic_xchg(&(p->state), 0) == 2)) {
+        ak_futex_wake(&(p->state), 1);
+    }
+}
+
+#elif AKMALLOC_LOCK_POLICY == AK_LOCK_POLICY_TICKET
+
+typedef struct ak_lock_tag ak_lock;
+
+struct ak_lock_tag
+{
+    ak_u32 next;
+    ak_u32 serving;
+    ak_u32 sleepers;                /**< waiters asleep on \p serving */
+};
+
+ak_inline static void ak_lock_init(ak_lock* p)
+{
+    p->next = p->serving = p->sleepers = 0;
+}
+
+/* the futex mask of the waiters of a ticket, so that a release only wakes the next in line */
+#define ak_lock_ticket_mask(t) (((ak_u32)1) << ((t) & 31))
+
+/*!
+ * Wait for \p p->serving to move on from \p curr, or to reach \p ticket when sleeping.
+ */
+static void ak_lock_wait(ak_lock* p, ak_u32 ticket, ak_u32 curr)
+{
+#if defined(AK_LOCK_PARK)
+    // the release reads the sleepers after publishing serving, so one of the two sees the other
+    ak_atomic_fetch_add(&(p->sleepers), 1);
+    ak_futex_wait_mask(&(p->serving), curr, ak_lock_ticket_mask(ticket));
+    ak_atomic_fetch_add(&(p->sleepers), (ak_u32)0 - 1);
+#else
+    (void)p;
+    (void)ticket;
+    (void)curr;
+    ak_spinlock_yield();
+#endif
+}
+
+ak_inline static void ak_lock_acquire(ak_lock* p)
+{
+    const ak_u32 ticket = ak_atomic_fetch_add(&(p->next), 1);
+    ak_u32 curr;
+    ak_u32 spins = 0;
+    while ((curr = *(volatile ak_u32*)(&(p->serving))) != ticket) {
+        if (spins < AK_LOCK_SPINS_BEFORE_WAIT) {
+            // back off in proportion to the number of threads ahead, every pause counts as a spin
+            for (ak_u32 i = (ticket - curr); i > 0; --i) {
+                ak_cpu_relax();
+            }
+            spins += (ticket - curr);
+        } else {
+            ak_lock_wait(p, ticket, curr);
+        }
+    }
+    ak_atomic_fence();
+}
+
+ak_inline static int ak_lock_try_acquire(ak_lock* p)
+{
+    const ak_u32 curr = *(volatile ak_u32*)(&(p->serving));
+    return ak_atomic_cas(&(p->next), curr + 1, curr);
+}
+
+ak_inline static void ak_lock_release(ak_lock* p)
+{
+    AKMALLOC_ASSERT(p->next != p->serving);
+    const ak_u32 next = p->serving + 1;
+    ak_atomic_store_release(&(p->serving), next);
+#if defined(AK_LOCK_PARK)
+    ak_atomic_fence();
+    if (ak_unlikely(*(volatile ak_u32*)(&(p->sleepers)))) {
+        ak_futex_wake_mask(&(p->serving), ak_lock_ticket_mask(next));
+    }
+#endif
+}
+
+#elif AKMALLOC_LOCK_POLICY == AK_LOCK_POLICY_MCS
+
+#if !defined(AK_MCS_MAX_HELD)
+/* number of MCS locks a thread may hold at once */
+#  define AK_MCS_MAX_HELD 4
+#endif
+
+typedef struct ak_mcs_node_tag ak_mcs_node;
+
+typedef struct ak_lock_tag ak_lock;
+
+/* locked is 0 once the lock is handed over, 1 while the waiter spins and 2 while it sleeps */
+struct ak_mcs_node_tag
+{
+    ak_mcs_node* next;
+    ak_u32       locked;
+    ak_u32       _unused;
+};
+
+/* the holder's node is kept in the lock since ak_lock_release does not get it from the caller */
+struct ak_lock_tag
+{
+    ak_mcs_node* tail;
+    ak_mcs_node* holder;
+};
+
+static ak_thread_local ak_mcs_node AK_MCS_NODES[AK_MCS_MAX_HELD];
+static ak_thread_local ak_u32 AK_MCS_USED = 0;
+
+ak_inline static ak_mcs_node* ak_mcs_node_get()
+{
+    const ak_u32 used = AK_MCS_USED;
+    ak_u32 idx = 0;
+    while (used & (1u << idx)) {
+        ++idx;
+    }
+    AKMALLOC_ASSERT_ALWAYS(idx < AK_MCS_MAX_HELD);
+    AK_MCS_USED = used | (1u << idx);
+    ak_mcs_node* n = AK_MCS_NODES + idx;
+    n->next = AK_NULLPTR;
+    n->locked = 1;
+    return n;
+}
+
+ak_inline static void ak_mcs_node_put(ak_mcs_node* n)
+{
+    AK_MCS_USED &= ~(1u << (ak_u32)(n - AK_MCS_NODES));
+}
+
+ak_inline static void ak_lock_init(ak_lock* p)
+{
+    p->tail = p->holder = AK_NULLPTR;
+}
+
+ak_inline static void ak_lock_acquire(ak_lock* p)
+{
+    ak_mcs_node* n = ak_mcs_node_get();
+    // publish the initialized node before linking it
+    ak_atomic_fence();
+    ak_mcs_node* pred = (ak_mcs_node*)ak_atomic_xchg_ptr(&(p->tail), n);
+    if (pred) {
+        ak_atomic_store_release(&(pred->next), n);
+        ak_u32 spins = 0;
+        while (*(volatile ak_u32*)(&(n->locked))) {
+            if (++spins < AK_LOCK_SPINS_BEFORE_WAIT) {
+                ak_cpu_relax();
+            } else {
+#if defined(AK_LOCK_PARK)
+                if (ak_atomic_cas(&(n->locked), 2, 1) || (*(volatile ak_u32*)(&(n->locked)) == 2)) {
+                    ak_futex_wait(&(n->locked), 2);
+                }
+#else
+                ak_spinlock_yield();
+#endif
+            }
+        }
+        ak_atomic_fence();
+    }
+    p->holder = n;
+}
+
+ak_inline static int ak_lock_try_acquire(ak_lock* p)
+{
+    if (*(ak_mcs_node* volatile*)(&(p->tail))) {
+        return 0;
+    }
+    ak_mcs_node* n = ak_mcs_node_get();
+    if (ak_atomic_cas_ptr(&(p->tail), n, AK_NULLPTR)) {
+        p->holder = n;
+        return 1;
+    }
+    ak_mcs_node_put(n);
+    return 0;
+}
+
+ak_inline static void ak_lock_release(ak_lock* p)
+{
+    ak_mcs_node* n = p->holder;
+    AKMALLOC_ASSERT(n);
+    ak_mcs_node* succ = *(ak_mcs_node* volatile*)(&(n->next));
+    if (!succ) {
+        if (ak_atomic_cas_ptr(&(p->tail), AK_NULLPTR, n)) {
+            ak_mcs_node_put(n);
+            return;
+        }
+        // a waiter swapped the tail but has not linked itself yet
+        while (!(succ = *(ak_mcs_node* volatile*)(&(n->next)))) {
+            ak_cpu_relax();
+        }
+    }
+#if defined(AK_LOCK_PARK)
+    ak_atomic_fence();
+    if (ak_unlikely(ak_atomic_xchg(&(succ->locked), 0) == 2)) {
+        ak_futex_wake(&(succ->locked), 1);
+    }
+#else
+    ak_atomic_store_release(&(succ->locked), 0);
+#endif
+    ak_mcs_node_put(n);
+}
+
+#else
+#  error "Unknown AKMALLOC_LOCK_POLICY."
+#endif
+
+/*
+ * Whether the allocator locks have to be taken. A process that never starts a second thread
+ * skips them, like glibc does with SINGLE_THREAD_P. glibc clears __libc_single_threaded in
+ * pthread_create() before the new thread exists, and the only thread cannot be inside the
+ * allocator at that point, so every lock that was skipped has also been released.
+ */
+#if !defined(AKMALLOC_SINGLE_THREAD_FAST_PATH)
+#  define AKMALLOC_SINGLE_THREAD_FAST_PATH 1
+#endif
+
+#if AKMALLOC_SINGLE_THREAD_FAST_PATH && defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#  if __GLIBC_PREREQ(2, 32)
+#    define AK_HAS_SINGLE_THREADED
+#  endif
+#endif
+
+#if defined(AK_HAS_SINGLE_THREADED)
+AK_EXTERN_C_BEGIN
+/* from sys/single_threaded.h, which is not always installed */
+extern char __libc_single_threaded;
+AK_EXTERN_C_END
+#  define ak_locks_needed() (!__libc_single_threaded)
+#else
+#  define ak_locks_needed() 1
+#endif
+
+#define ak_lock_acquire_if_needed(p)     (ak_locks_needed() ? ak_lock_acquire(p) : (void)0)
+#define ak_lock_try_acquire_if_needed(p) (!ak_locks_needed() || ak_lock_try_acquire(p))
+#define ak_lock_release_if_needed(p)     (ak_locks_needed() ? ak_lock_release(p) : (void)0)
+/********************** lock end ************************/
+
+
 /********************** bitset begin ************************/
 #if AKMALLOC_MSVC
 #include <intrin.h>
@@ -538,585 +1022,334 @@ ak_inline static void ak_bitset_flip(ak_bitset32* bs)
     *bs = ~(*bs);
 }
 
+/* ak_bitset64 */
+
+typedef ak_u64 ak_bitset64;
+
+#define AK_BITSET64_ALL (~((ak_bitset64)0))
+
+#if AKMALLOC_MSVC && (defined(_M_AMD64) || defined(_M_ARM64))
+#  define ak_bitset64_fill_num_leading_zeros(bs, out)             \
+     do {                                                         \
+        DWORD ldz = 0;                                            \
+        out = (_BitScanReverse64(&ldz, *(bs))) ? (63 - ldz) : 64; \
+     } while (0)
+#  define ak_bitset64_fill_num_trailing_zeros(bs, out)            \
+     do {                                                         \
+        DWORD trz = 0;                                            \
+        out = (_BitScanForward64(&trz, *(bs))) ? trz : 64;        \
+     } while (0)
+#elif AKMALLOC_MSVC
+   /* no 64 bit scans on 32 bit targets, scan the halves */
+#  define ak_bitset64_fill_num_leading_zeros(bs, out)             \
+     do {                                                         \
+        ak_bitset32 hi = (ak_bitset32)(*(bs) >> 32);              \
+        ak_bitset32 lo = (ak_bitset32)(*(bs));                    \
+        int nlzhalf;                                              \
+        if (hi) {                                                 \
+            ak_bitset_fill_num_leading_zeros(&hi, nlzhalf);       \
+            out = nlzhalf;                                        \
+        } else {                                                  \
+            ak_bitset_fill_num_leading_zeros(&lo, nlzhalf);       \
+            out = 32 + nlzhalf;                                   \
+        }                                                         \
+     } while (0)
+#  define ak_bitset64_fill_num_trailing_zeros(bs, out)            \
+     do {                                                         \
+        ak_bitset32 hi = (ak_bitset32)(*(bs) >> 32);              \
+        ak_bitset32 lo = (ak_bitset32)(*(bs));                    \
+        int ntzhalf;                                              \
+        if (lo) {                                                 \
+            ak_bitset_fill_num_trailing_zeros(&lo, ntzhalf);      \
+            out = ntzhalf;                                        \
+        } else {                                                  \
+            ak_bitset_fill_num_trailing_zeros(&hi, ntzhalf);      \
+            out = 32 + ntzhalf;                                   \
+        }                                                         \
+     } while (0)
+#else
+#  define ak_bitset64_fill_num_leading_zeros(bs, out)             \
+     out = (*(bs)) ? __builtin_clzll(*(bs)) : 64
+#  define ak_bitset64_fill_num_trailing_zeros(bs, out)            \
+     out = (*(bs)) ? __builtin_ctzll(*(bs)) : 64
+#endif
+
 /* ak_bitset512 */
 
+/*
+ * Eight 64 bit words, bit i lives at bit (i & 63) of word (i >> 6). Searches look at a whole
+ * word per step, and the reductions over all words are plain loops the compiler unrolls and
+ * vectorizes.
+ */
+#define AK_BITSET512_WORDS 8
+
 struct ak_bitset512_tag
 {
-    ak_bitset32 a0;
-    ak_bitset32 a1;
-    ak_bitset32 a2;
-    ak_bitset32 a3;
-    ak_bitset32 a4;
-    ak_bitset32 a5;
-    ak_bitset32 a6;
-    ak_bitset32 a7;
-    ak_bitset32 a8;
-    ak_bitset32 a9;
-    ak_bitset32 a10;
-    ak_bitset32 a11;
-    ak_bitset32 a12;
-    ak_bitset32 a13;
-    ak_bitset32 a14;
-    ak_bitset32 a15;
+    ak_bitset64 a[AK_BITSET512_WORDS];
 };
 
 typedef struct ak_bitset512_tag ak_bitset512;
 
 ak_inline static int ak_bitset512_all(const ak_bitset512* bs)
 {
-    return ak_bitset_all(&(bs->a0))  &&
-           ak_bitset_all(&(bs->a1))  &&
-           ak_bitset_all(&(bs->a2))  &&
-           ak_bitset_all(&(bs->a3))  &&
-           ak_bitset_all(&(bs->a4))  &&
-           ak_bitset_all(&(bs->a5))  &&
-           ak_bitset_all(&(bs->a6))  &&
-           ak_bitset_all(&(bs->a7))  &&
-           ak_bitset_all(&(bs->a8))  &&
-           ak_bitset_all(&(bs->a9))  &&
-           ak_bitset_all(&(bs->a10)) &&
-           ak_bitset_all(&(bs->a11)) &&
-           ak_bitset_all(&(bs->a12)) &&
-           ak_bitset_all(&(bs->a13)) &&
-           ak_bitset_all(&(bs->a14)) &&
-           ak_bitset_all(&(bs->a15));
+    ak_bitset64 acc = AK_BITSET64_ALL;
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        acc &= bs->a[w];
+    }
+    return (acc == AK_BITSET64_ALL) ? 1 : 0;
 }
 
 ak_inline static int ak_bitset512_any(const ak_bitset512* bs)
 {
-    return ak_bitset_any(&(bs->a0))  ||
-           ak_bitset_any(&(bs->a1))  ||
-           ak_bitset_any(&(bs->a2))  ||
-           ak_bitset_any(&(bs->a3))  ||
-           ak_bitset_any(&(bs->a4))  ||
-           ak_bitset_any(&(bs->a5))  ||
-           ak_bitset_any(&(bs->a6))  ||
-           ak_bitset_any(&(bs->a7))  ||
-           ak_bitset_any(&(bs->a8))  ||
-           ak_bitset_any(&(bs->a9))  ||
-           ak_bitset_any(&(bs->a10)) ||
-           ak_bitset_any(&(bs->a11)) ||
-           ak_bitset_any(&(bs->a12)) ||
-           ak_bitset_any(&(bs->a13)) ||
-           ak_bitset_any(&(bs->a14)) ||
-           ak_bitset_any(&(bs->a15));
+    ak_bitset64 acc = 0;
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        acc |= bs->a[w];
+    }
+    return (acc != 0) ? 1 : 0;
 }
 
 ak_inline static int ak_bitset512_none(const ak_bitset512* bs)
 {
-    return ak_bitset_none(&(bs->a0))  &&
-           ak_bitset_none(&(bs->a1))  &&
-           ak_bitset_none(&(bs->a2))  &&
-           ak_bitset_none(&(bs->a3))  &&
-           ak_bitset_none(&(bs->a4))  &&
-           ak_bitset_none(&(bs->a5))  &&
-           ak_bitset_none(&(bs->a6))  &&
-           ak_bitset_none(&(bs->a7))  &&
-           ak_bitset_none(&(bs->a8))  &&
-           ak_bitset_none(&(bs->a9))  &&
-           ak_bitset_none(&(bs->a10)) &&
-           ak_bitset_none(&(bs->a11)) &&
-           ak_bitset_none(&(bs->a12)) &&
-           ak_bitset_none(&(bs->a13)) &&
-           ak_bitset_none(&(bs->a14)) &&
-           ak_bitset_none(&(bs->a15));
+    return !ak_bitset512_any(bs);
 }
 
 ak_inline static void ak_bitset512_set_all(ak_bitset512* bs)
 {
-    ak_bitset_set_all(&(bs->a0));
-    ak_bitset_set_all(&(bs->a1));
-    ak_bitset_set_all(&(bs->a2));
-    ak_bitset_set_all(&(bs->a3));
-    ak_bitset_set_all(&(bs->a4));
-    ak_bitset_set_all(&(bs->a5));
-    ak_bitset_set_all(&(bs->a6));
-    ak_bitset_set_all(&(bs->a7));
-    ak_bitset_set_all(&(bs->a8));
-    ak_bitset_set_all(&(bs->a9));
-    ak_bitset_set_all(&(bs->a10));
-    ak_bitset_set_all(&(bs->a11));
-    ak_bitset_set_all(&(bs->a12));
-    ak_bitset_set_all(&(bs->a13));
-    ak_bitset_set_all(&(bs->a14));
-    ak_bitset_set_all(&(bs->a15));
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        bs->a[w] = AK_BITSET64_ALL;
+    }
 }
 
 ak_inline static void ak_bitset512_clear_all(ak_bitset512* bs)
 {
-    ak_bitset_clear_all(&(bs->a0));
-    ak_bitset_clear_all(&(bs->a1));
-    ak_bitset_clear_all(&(bs->a2));
-    ak_bitset_clear_all(&(bs->a3));
-    ak_bitset_clear_all(&(bs->a4));
-    ak_bitset_clear_all(&(bs->a5));
-    ak_bitset_clear_all(&(bs->a6));
-    ak_bitset_clear_all(&(bs->a7));
-    ak_bitset_clear_all(&(bs->a8));
-    ak_bitset_clear_all(&(bs->a9));
-    ak_bitset_clear_all(&(bs->a10));
-    ak_bitset_clear_all(&(bs->a11));
-    ak_bitset_clear_all(&(bs->a12));
-    ak_bitset_clear_all(&(bs->a13));
-    ak_bitset_clear_all(&(bs->a14));
-    ak_bitset_clear_all(&(bs->a15));
-}
-
-ak_inline static void ak_bitset512_set(ak_bitset512* bs, int idx)
-{
-    switch (idx >> 5) {
-        case 0:
-            ak_bitset_set(&(bs->a15), idx & 31);
-            return;
-        case 1:
-            ak_bitset_set(&(bs->a14), idx & 31);
-            return;
-        case 2:
-            ak_bitset_set(&(bs->a13), idx & 31);
-            return;
-        case 3:
-            ak_bitset_set(&(bs->a12), idx & 31);
-            return;
-        case 4:
-            ak_bitset_set(&(bs->a11), idx & 31);
-            return;
-        case 5:
-            ak_bitset_set(&(bs->a10), idx & 31);
-            return;
-        case 6:
-            ak_bitset_set(&(bs->a9), idx & 31);
-            return;
-        case 7:
-            ak_bitset_set(&(bs->a8), idx & 31);
-            return;
-        case 8:
-            ak_bitset_set(&(bs->a7), idx & 31);
-            return;
-        case 9:
-            ak_bitset_set(&(bs->a6), idx & 31);
-            return;
-        case 10:
-            ak_bitset_set(&(bs->a5), idx & 31);
-            return;
-        case 11:
-            ak_bitset_set(&(bs->a4), idx & 31);
-            return;
-        case 12:
-            ak_bitset_set(&(bs->a3), idx & 31);
-            return;
-        case 13:
-            ak_bitset_set(&(bs->a2), idx & 31);
-            return;
-        case 14:
-            ak_bitset_set(&(bs->a1), idx & 31);
-            return;
-        case 15:
-            ak_bitset_set(&(bs->a0), idx & 31);
-            return;
-        default:
-            AKMALLOC_ASSERT_ALWAYS(0 && "Invalid bitset index");
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        bs->a[w] = 0;
     }
-    return;
 }
 
-ak_inline static void ak_bitset512_clear(ak_bitset512* bs, int idx)
+/*!
+ * Set bits [0, n) and clear the rest.
+ */
+ak_inline static void ak_bitset512_set_first_n(ak_bitset512* bs, int n)
 {
-    switch (idx >> 5) {
-        case 0:
-            ak_bitset_clear(&(bs->a15), idx & 31);
-            return;
-        case 1:
-            ak_bitset_clear(&(bs->a14), idx & 31);
-            return;
-        case 2:
-            ak_bitset_clear(&(bs->a13), idx & 31);
-            return;
-        case 3:
-            ak_bitset_clear(&(bs->a12), idx & 31);
-            return;
-        case 4:
-            ak_bitset_clear(&(bs->a11), idx & 31);
-            return;
-        case 5:
-            ak_bitset_clear(&(bs->a10), idx & 31);
-            return;
-        case 6:
-            ak_bitset_clear(&(bs->a9), idx & 31);
-            return;
-        case 7:
-            ak_bitset_clear(&(bs->a8), idx & 31);
-            return;
-        case 8:
-            ak_bitset_clear(&(bs->a7), idx & 31);
-            return;
-        case 9:
-            ak_bitset_clear(&(bs->a6), idx & 31);
-            return;
-        case 10:
-            ak_bitset_clear(&(bs->a5), idx & 31);
-            return;
-        case 11:
-            ak_bitset_clear(&(bs->a4), idx & 31);
-            return;
-        case 12:
-            ak_bitset_clear(&(bs->a3), idx & 31);
-            return;
-        case 13:
-            ak_bitset_clear(&(bs->a2), idx & 31);
-            return;
-        case 14:
-            ak_bitset_clear(&(bs->a1), idx & 31);
-            return;
-        case 15:
-            ak_bitset_clear(&(bs->a0), idx & 31);
-            return;
-        default:
-            AKMALLOC_ASSERT_ALWAYS(0 && "Invalid bitset index");
-    }
-    return;
-}
-
-ak_inline static ak_bitset32 ak_bitset512_get(const ak_bitset512* bs, int idx)
-{
-    switch (idx >> 5) {
-        case 0:
-            return ak_bitset_get(&(bs->a15), idx & 31);
-        case 1:
-            return ak_bitset_get(&(bs->a14), idx & 31);
-        case 2:
-            return ak_bitset_get(&(bs->a13), idx & 31);
-        case 3:
-            return ak_bitset_get(&(bs->a12), idx & 31);
-        case 4:
-            return ak_bitset_get(&(bs->a11), idx & 31);
-        case 5:
-            return ak_bitset_get(&(bs->a10), idx & 31);
-        case 6:
-            return ak_bitset_get(&(bs->a9), idx & 31);
-        case 7:
-            return ak_bitset_get(&(bs->a8), idx & 31);
-        case 8:
-            return ak_bitset_get(&(bs->a7), idx & 31);
-        case 9:
-            return ak_bitset_get(&(bs->a6), idx & 31);
-        case 10:
-            return ak_bitset_get(&(bs->a5), idx & 31);
-        case 11:
-            return ak_bitset_get(&(bs->a4), idx & 31);
-        case 12:
-            return ak_bitset_get(&(bs->a3), idx & 31);
-        case 13:
-            return ak_bitset_get(&(bs->a2), idx & 31);
-        case 14:
-            return ak_bitset_get(&(bs->a1), idx & 31);
-        case 15:
-            return ak_bitset_get(&(bs->a0), idx & 31);
-        default:
-            AKMALLOC_ASSERT_ALWAYS(0 && "Invalid bitset index");
-            return 0;
+    AKMALLOC_ASSERT(n >= 0 && n <= 512);
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        const int nw = n - (w << 6);
+        bs->a[w] = (nw >= 64) ? AK_BITSET64_ALL : ((nw <= 0) ? 0 : ~(AK_BITSET64_ALL << nw));
     }
 }
 
-#define ak_bitset512_fill_num_leading_zeros(bs, nlz)            \
-    nlz = 0;                                                    \
-    {                                                           \
-        int cur = 0;                                            \
-        ak_bitset_fill_num_leading_zeros(&(bs->a0), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a1), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a2), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a3), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a4), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a5), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a6), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a7), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a8), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a9), cur);       \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a10), cur);      \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a11), cur);      \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a12), cur);      \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a13), cur);      \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a14), cur);      \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_leading_zeros(&(bs->a15), cur);      \
-        nlz += cur;                                             \
-        } } } } } } } } } } } } } } }                           \
-    }
-
-#define ak_bitset512_fill_num_leading_ones(bs, nlz)             \
-    nlz = 0;                                                    \
-    {                                                           \
-        int cur = 0;                                            \
-        ak_bitset32 mybs;                                       \
-        mybs = ~(bs->a0);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a1);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a2);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a3);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a4);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a5);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a6);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a7);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a8);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a9);                                       \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a10);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a11);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a12);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a13);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a14);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a15);                                      \
-        ak_bitset_fill_num_leading_zeros(&mybs, cur);           \
-        nlz += cur;                                             \
-        } } } } } } } } } } } } } } }                           \
-    }
+#define ak_bitset512_word(bs, i) ((bs)->a[(i) >> 6])
 
-ak_inline static int ak_bitset512_num_leading_zeros(const ak_bitset512* bs)
+#define ak_bitset512_mask(i) (((ak_bitset64)1) << ((i) & 63))
+
+ak_inline static void ak_bitset512_set(ak_bitset512* bs, int i)
 {
-    int nlz = 0;
-    ak_bitset512_fill_num_leading_zeros(bs, nlz);
-    return nlz;
+    AKMALLOC_ASSERT(i >= 0 && i < 512);
+    ak_bitset512_word(bs, i) |= ak_bitset512_mask(i);
 }
 
-#define ak_bitset512_fill_num_trailing_zeros(bs, ntz)           \
-    ntz = 0;                                                    \
-    {                                                           \
-        int cur = 0;                                            \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a15), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a14), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a13), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a12), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a11), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a10), cur);     \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a9), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a8), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a7), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a6), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a5), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a4), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a3), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a2), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a1), cur);      \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        ak_bitset_fill_num_trailing_zeros(&(bs->a0), cur);      \
-        ntz += cur;                                             \
-        } } } } } } } } } } } } } } }                           \
-    }
-
-#define ak_bitset512_fill_num_trailing_ones(bs, ntz)            \
-    ntz = 0;                                                    \
-    {                                                           \
-        int cur = 0;                                            \
-        ak_bitset32 mybs;                                       \
-        mybs = ~(bs->a15);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a14);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a13);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a12);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a11);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a10);                                      \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a9);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a8);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a7);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a6);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a5);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a4);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a3);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a2);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a1);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        if (cur == 32) {                                        \
-        mybs = ~(bs->a0);                                       \
-        ak_bitset_fill_num_trailing_zeros(&mybs, cur);          \
-        ntz += cur;                                             \
-        } } } } } } } } } } } } } } }                           \
-    }
+ak_inline static void ak_bitset512_clear(ak_bitset512* bs, int i)
+{
+    AKMALLOC_ASSERT(i >= 0 && i < 512);
+    ak_bitset512_word(bs, i) &= ~ak_bitset512_mask(i);
+}
 
+ak_inline static int ak_bitset512_get(const ak_bitset512* bs, int i)
+{
+    AKMALLOC_ASSERT(i >= 0 && i < 512);
+    return (ak_bitset512_word(bs, i) & ak_bitset512_mask(i)) ? 1 : 0;
+}
 
 ak_inline static int ak_bitset512_num_trailing_zeros(const ak_bitset512* bs)
 {
-    int ntz = 0;
-    ak_bitset512_fill_num_trailing_zeros(bs, ntz);
-    return ntz;
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        if (bs->a[w]) {
+            int ntz;
+            ak_bitset64_fill_num_trailing_zeros(&(bs->a[w]), ntz);
+            return (w << 6) + ntz;
+        }
+    }
+    return 512;
 }
 
-ak_inline static void ak_bitset512_flip(ak_bitset512* bs)
+ak_inline static int ak_bitset512_num_trailing_ones(const ak_bitset512* bs)
+{
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        const ak_bitset64 v = ~(bs->a[w]);
+        if (v) {
+            int ntz;
+            ak_bitset64_fill_num_trailing_zeros(&v, ntz);
+            return (w << 6) + ntz;
+        }
+    }
+    return 512;
+}
+
+ak_inline static int ak_bitset512_num_leading_zeros(const ak_bitset512* bs)
 {
-    ak_bitset_flip(&(bs->a0));
-    ak_bitset_flip(&(bs->a1));
-    ak_bitset_flip(&(bs->a2));
-    ak_bitset_flip(&(bs->a3));
-    ak_bitset_flip(&(bs->a4));
-    ak_bitset_flip(&(bs->a5));
-    ak_bitset_flip(&(bs->a6));
-    ak_bitset_flip(&(bs->a7));
-    ak_bitset_flip(&(bs->a8));
-    ak_bitset_flip(&(bs->a9));
-    ak_bitset_flip(&(bs->a10));
-    ak_bitset_flip(&(bs->a11));
-    ak_bitset_flip(&(bs->a12));
-    ak_bitset_flip(&(bs->a13));
-    ak_bitset_flip(&(bs->a14));
-    ak_bitset_flip(&(bs->a15));
+    for (int w = AK_BITSET512_WORDS - 1; w >= 0; --w) {
+        if (bs->a[w]) {
+            int nlz;
+            ak_bitset64_fill_num_leading_zeros(&(bs->a[w]), nlz);
+            return ((AK_BITSET512_WORDS - 1 - w) << 6) + nlz;
+        }
+    }
+    return 512;
 }
 
 ak_inline static int ak_bitset512_num_leading_ones(const ak_bitset512* bs)
 {
-    int nlo;
-    ak_bitset512_fill_num_leading_ones(bs, nlo);
-    return nlo;
+    for (int w = AK_BITSET512_WORDS - 1; w >= 0; --w) {
+        const ak_bitset64 v = ~(bs->a[w]);
+        if (v) {
+            int nlz;
+            ak_bitset64_fill_num_leading_zeros(&v, nlz);
+            return ((AK_BITSET512_WORDS - 1 - w) << 6) + nlz;
+        }
+    }
+    return 512;
 }
 
-ak_inline static int ak_bitset512_num_trailing_ones(const ak_bitset512* bs)
+ak_inline static void ak_bitset512_flip(ak_bitset512* bs)
 {
-    int nto;
-    ak_bitset512_fill_num_trailing_ones(bs, nto);
-    return nto;
+    for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+        bs->a[w] = ~(bs->a[w]);
+    }
 }
 /********************** bitset end ************************/
 
+/********************** numa begin ************************/
+/*!
+ * \page numa NUMA placement
+ *
+ * With <tt>AKMALLOC_NUMA</tt> (Linux only) every NUMA node gets its own arenas (see \ref arenas).
+ * A thread is bound to an arena of the node it runs on when it first allocates, and memory
+ * obtained from the OS while the thread allocates is placed on that node with <tt>mbind()</tt>.
+ * Memory freed by a thread on another node goes back to the arena that owns it, and is never
+ * kept in the thread cache of the freeing thread or the CPU cache of the CPU it runs on.
+ *
+ * The topology is read from <tt>/sys/devices/system/node/possible</tt>. Setting the environment
+ * variable <tt>AKMALLOC_NUMA_NODES</tt>, or defining it at compile time, pretends that there are
+ * that many nodes, and threads are then spread over them round robin instead of by the node they
+ * run on. The environment takes precedence. Pages are only bound to nodes that exist. This allows
+ * running the multi-node paths on a single node machine.
+ */
+#if !defined(AKMALLOC_NUMA)
+#  define AKMALLOC_NUMA 0
+#endif
+
+#if !defined(AKMALLOC_NUMA_NODES)
+#  define AKMALLOC_NUMA_NODES 0
+#endif
+
+#if AKMALLOC_NUMA
+
+#if !AKMALLOC_LINUX
+#  error "AKMALLOC_NUMA is only supported on Linux."
+#endif
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* from numaif.h, which is not always installed */
+#define AK_NUMA_MPOL_PREFERRED 1
+
+#define AK_NUMA_MAX_NODES 256
+
+static ak_u32 NUMA_NODES = 1;       /* nodes that arenas are spread over */
+static ak_u32 NUMA_OS_NODES = 1;    /* nodes that exist */
+static ak_u32 NUMA_OVERRIDE = 0;    /* whether the nodes were set by the environment */
+static ak_u32 NUMA_NEXT = 0;        /* next node to hand out when overridden */
+
+static ak_thread_local ak_u32 AK_NUMA_NODE = AK_U32_MAX;
+
+static ak_u32 ak_numa_parse_u32(const char* s)
+{
+    ak_u32 v = 0;
+    for (; (*s >= '0') && (*s <= '9'); ++s) {
+        v = (v * 10) + (ak_u32)(*s - '0');
+    }
+    return v;
+}
+
+static ak_u32 ak_numa_os_nodes()
+{
+    // a list such as "0", "0-3" or "0,2-3": the last number is the highest node
+    char buf[64];
+    int fd = open("/sys/devices/system/node/possible", O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 1;
+    }
+    buf[n] = 0;
+    const char* last = buf;
+    for (ssize_t i = 1; i < n; ++i) {
+        if ((buf[i] >= '0') && (buf[i] <= '9') && ((buf[i - 1] < '0') || (buf[i - 1] > '9'))) {
+            last = buf + i;
+        }
+    }
+    return ak_numa_parse_u32(last) + 1;
+}
+
+static void ak_numa_init_global()
+{
+    NUMA_OS_NODES = ak_numa_os_nodes();
+    NUMA_NODES = NUMA_OS_NODES;
+    const char* env = getenv("AKMALLOC_NUMA_NODES");
+    const ak_u32 n = env ? ak_numa_parse_u32(env) : 0;
+    if ((n > 0) || (AKMALLOC_NUMA_NODES > 0)) {
+        NUMA_NODES = (n > 0) ? n : (ak_u32)(AKMALLOC_NUMA_NODES);
+        NUMA_OVERRIDE = 1;
+    }
+}
+
+/*!
+ * Get the node that the calling thread should allocate from.
+ * \return The node, less than \c NUMA_NODES.
+ */
+static ak_u32 ak_numa_current_node()
+{
+    if (NUMA_OVERRIDE) {
+        return ak_atomic_fetch_add(&NUMA_NEXT, 1) % NUMA_NODES;
+    }
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, AK_NULLPTR) != 0) {
+        return 0;
+    }
+    return node % NUMA_NODES;
+}
+
+/*!
+ * Prefer the calling thread's node for memory just obtained from the OS.
+ * \param mem; The memory, not yet touched
+ * \param sz; Its size
+ */
+static void ak_numa_bind(void* mem, ak_sz sz)
+{
+    const ak_u32 node = AK_NUMA_NODE;
+    if ((NUMA_OS_NODES > 1) && (node < NUMA_OS_NODES) && (node < AK_NUMA_MAX_NODES)) {
+        const ak_sz bits = 8 * sizeof(unsigned long);
+        unsigned long mask[AK_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+        mask[node / bits] = 1UL << (node % bits);
+        // a failure leaves the default policy, which is still correct
+        (void)syscall(SYS_mbind, mem, sz, AK_NUMA_MPOL_PREFERRED, mask, (unsigned long)AK_NUMA_MAX_NODES, 0);
+    }
+}
+
+#  define ak_numa_set_node(n) (AK_NUMA_NODE = (n))
+#else
+#  define ak_numa_bind(mem, sz)
+#endif/*AKMALLOC_NUMA*/
+/********************** numa end ************************/
+
 /********************** os alloc begin ********/
 #if defined(AKMALLOC_GETPAGESIZE)
 #  error "Page size can only be set to an internal default."
@@ -1202,6 +1435,9 @@ static void* ak_os_alloc(size_t sz)
     (void)(pgsz);
     AKMALLOC_ASSERT_ALWAYS(pgsz == ak_page_size());
     void* mem = AKMALLOC_MMAP(sz);
+    if (ak_likely(mem)) {
+        ak_numa_bind(mem, sz);
+    }
     DBG_PRINTF("osmap,%p,%zu,%zu pages,iswhole %d\n", mem, sz, sz/AKMALLOC_DEFAULT_PAGE_SIZE, sz == AKMALLOC_DEFAULT_PAGE_SIZE*(sz/AKMALLOC_DEFAULT_PAGE_SIZE));
     return mem;
 }
@@ -1211,16 +1447,6 @@ static void ak_os_free(void* p, size_t sz)
     DBG_PRINTF("osunmap,%p,%zu\n", p, sz);
     AKMALLOC_MUNMAP(p, sz);
 }
-
-ak_inline static void* ak_page_start_before(void* p)
-{
-    return (void*)((ak_sz)p & (~(ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1)));
-}
-
-ak_inline static const void* ak_page_start_before_const(const void* p)
-{
-    return (void*)((ak_sz)p & (~(ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1)));
-}
 /********************** os alloc end **********/
 
 /********************** mallocstate config begin **********/
@@ -1235,10 +1461,10 @@ ak_inline static const void* ak_page_start_before_const(const void* p)
 #if defined(AK_MALLOCSTATE_USE_LOCKS)
 #  define AK_SLAB_USE_LOCKS
 #  define AK_CA_USE_LOCKS
-#  define AKMALLOC_LOCK_DEFINE(nm)  ak_spinlock nm
-#  define AKMALLOC_LOCK_INIT(lk)    ak_spinlock_init((lk))
-#  define AKMALLOC_LOCK_ACQUIRE(lk) ak_spinlock_acquire((lk))
-#  define AKMALLOC_LOCK_RELEASE(lk) ak_spinlock_release((lk))
+#  define AKMALLOC_LOCK_DEFINE(nm)  ak_lock nm
+#  define AKMALLOC_LOCK_INIT(lk)    ak_lock_init((lk))
+#  define AKMALLOC_LOCK_ACQUIRE(lk) ak_lock_acquire_if_needed((lk))
+#  define AKMALLOC_LOCK_RELEASE(lk) ak_lock_release_if_needed((lk))
 #else
 #  define AKMALLOC_LOCK_DEFINE(nm)
 #  define AKMALLOC_LOCK_INIT(lk)
@@ -1246,10 +1472,138 @@ ak_inline static const void* ak_page_start_before_const(const void* p)
 #  define AKMALLOC_LOCK_RELEASE(lk)
 #endif
 
+/*!
+ * Decide to use or not use per-CPU magazines of small objects for malloc()/free()
+ */
+#if !defined(AKMALLOC_CPU_CACHE)
+#  define AKMALLOC_CPU_CACHE 0
+#endif
+
+/*!
+ * Decide to use or not use a per-thread cache of small objects for malloc()/free()
+ */
+#if !defined(AKMALLOC_THREAD_CACHE)
+#  if defined(AK_MALLOCSTATE_USE_LOCKS) && !AKMALLOC_CPU_CACHE
+#    define AKMALLOC_THREAD_CACHE 1
+#  else
+#    define AKMALLOC_THREAD_CACHE 0
+#  endif
+#endif
+
+#if AKMALLOC_THREAD_CACHE && AKMALLOC_CPU_CACHE
+#  error "Only one of AKMALLOC_THREAD_CACHE and AKMALLOC_CPU_CACHE can be enabled."
+#endif
+
+/*!
+ * Decide to use or not use several malloc states (arenas) for malloc()/free()
+ */
+#if !defined(AKMALLOC_ARENAS)
+#  define AKMALLOC_ARENAS AKMALLOC_NUMA
+#endif
+
+#if AKMALLOC_NUMA && !AKMALLOC_ARENAS
+#  error "AKMALLOC_NUMA requires AKMALLOC_ARENAS."
+#endif
+
+#if AKMALLOC_ARENAS && !defined(AK_MALLOCSTATE_USE_LOCKS)
+#  error "AKMALLOC_ARENAS requires locks to be enabled."
+#endif
+
+#if AKMALLOC_ARENAS || AKMALLOC_CPU_CACHE
+/*!
+ * Number of CPUs, to size the arenas and the per-CPU magazines.
+ */
+static ak_u32 ak_os_num_cpus()
+{
+#if AKMALLOC_WINDOWS
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (si.dwNumberOfProcessors > 0) ? (ak_u32)si.dwNumberOfProcessors : 1;
+#else
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    return (ncpus > 0) ? (ak_u32)ncpus : 1;
+#endif
+}
+#endif
+
+/*!
+ * Decide to use or not use a queue for frees that are handed off to another thread
+ */
+#if !defined(AKMALLOC_ASYNC_FREE)
+#  define AKMALLOC_ASYNC_FREE 1
+#endif
+
+/*
+ * A coalesced block can be larger than the size range of the root it came from (an unsplit
+ * remainder, or growth by realloc in place), so its size does not always name its root. With
+ * locks, freeing to the wrong root races with the owner, and arenas also need the owner of
+ * mmap-ed memory. In both cases the owner is looked up in the page map.
+ */
+#if defined(AK_MALLOCSTATE_USE_LOCKS)
+#  define AK_USE_PAGEMAP
+#endif
+
+/*!
+ * Decide to use or not use the page map to tell slab objects apart instead of a header word
+ */
+#if !defined(AKMALLOC_SLAB_HEADERLESS)
+#  define AKMALLOC_SLAB_HEADERLESS 1
+#endif
+
+#if AKMALLOC_SLAB_HEADERLESS
+#  define AK_SLAB_HEADERLESS
+#  if !defined(AK_USE_PAGEMAP)
+#    define AK_USE_PAGEMAP
+#  endif
+#endif
+
+/*!
+ * Decide to use or not use slabs that span several pages for sizes above the slab sizes
+ */
+#if !defined(AKMALLOC_SLAB_SPANS)
+#  define AKMALLOC_SLAB_SPANS AKMALLOC_SLAB_HEADERLESS
+#endif
+
+#if AKMALLOC_SLAB_SPANS
+#  if !AKMALLOC_SLAB_HEADERLESS
+#    error "AKMALLOC_SLAB_SPANS requires AKMALLOC_SLAB_HEADERLESS."
+#  endif
+#  define AK_SLAB_SPANS
+#endif
+
+/*!
+ * Decide to use or not use lock-free claiming of slab objects
+ */
+#if !defined(AKMALLOC_SLAB_LOCKFREE)
+#  define AKMALLOC_SLAB_LOCKFREE 0
+#endif
+
+#if AKMALLOC_SLAB_LOCKFREE
+#  if !defined(AK_MALLOCSTATE_USE_LOCKS)
+#    error "AKMALLOC_SLAB_LOCKFREE requires locks to be enabled."
+#  endif
+#  define AK_SLAB_LOCKFREE
+#endif
+
 #if !defined(AK_COALESCE_SEGMENT_GRANULARITY)
 #  define AK_COALESCE_SEGMENT_GRANULARITY (((size_t)1) << 18) /* 256KB */
 #endif
 
+/*!
+ * Decide to use or not use larger slab sizes when the lock of a slab size is busy
+ */
+#if !defined(AKMALLOC_SLAB_SPILLOVER)
+#  define AKMALLOC_SLAB_SPILLOVER 0
+#endif
+
+#if !defined(AK_SLAB_SPILL_TRIES)
+#  define AK_SLAB_SPILL_TRIES 4
+#endif
+
+#if !defined(AK_SLAB_SPILL_CLASSES)
+#  define AK_SLAB_SPILL_CLASSES 2
+#endif
+
 #if !defined(AK_SEG_CBK_DEFINED)
 /**
  * Gets a pointer to a memory segment and its size.
@@ -1261,8 +1615,114 @@ ak_inline static const void* ak_page_start_before_const(const void* p)
 typedef int(*ak_seg_cbk)(const void*, size_t);
 #endif
 
+#if !defined(AK_MALLOC_STATS_DEFINED)
+/**
+ * Allocator statistics.
+ */
+typedef struct ak_malloc_stats_tag
+{
+    size_t slab_spills;        /**< small allocations served by a larger slab size because of contention */
+    size_t async_free_backlog; /**< frees queued by ak_free_async() and not yet performed */
+} ak_malloc_stats;
+#endif
+
 /********************** mallocstate config end ************/
 
+/********************** page map begin ************************/
+/*!
+ * The page map records a pointer sized value for every page of memory obtained from the OS that
+ * it was asked to track. It is a radix tree over page numbers whose inner nodes and leaves are
+ * obtained from the OS on first use and never returned.
+ *
+ * It is used to find the owner of coalesced and mmap-ed memory, which has no room in its
+ * header to name the allocator that it came from. Slab pages record the slab that they belong to
+ * tagged with \p AK_PAGEMAP_SLAB, so slab objects need no header at all, and objects of slabs that
+ * span several pages find their slab.
+ */
+#if defined(AK_USE_PAGEMAP)
+
+#define AK_PAGEMAP_PAGE_BITS 12
+
+#if AKMALLOC_BITNESS == 64
+/* 48-bit address spaces */
+#  define AK_PAGEMAP_TOP_BITS  12
+#  define AK_PAGEMAP_MID_BITS  12
+#  define AK_PAGEMAP_LEAF_BITS 12
+#else
+#  define AK_PAGEMAP_TOP_BITS  0
+#  define AK_PAGEMAP_MID_BITS  10
+#  define AK_PAGEMAP_LEAF_BITS 10
+#endif
+
+#define AK_PAGEMAP_MID_MASK  ((AK_SZ_ONE << AK_PAGEMAP_MID_BITS) - 1)
+#define AK_PAGEMAP_LEAF_MASK ((AK_SZ_ONE << AK_PAGEMAP_LEAF_BITS) - 1)
+
+/* roots and slabs are at least 16-byte aligned, so the low bit is free to tag slab pages */
+#define AK_PAGEMAP_SLAB ((ak_sz)1)
+
+static ak_sz** AK_PAGEMAP[AK_SZ_ONE << AK_PAGEMAP_TOP_BITS];
+
+ak_inline static void* ak_pagemap_new_node(void** slot, ak_sz sz)
+{
+    void* node = *(void* volatile*)slot;
+    if (!node) {
+        void* mem = ak_os_alloc(sz);
+        if (ak_unlikely(!mem)) {
+            return AK_NULLPTR;
+        }
+        if (ak_atomic_cas_ptr(slot, mem, AK_NULLPTR)) {
+            node = mem;
+        } else {
+            // somebody else installed the node
+            ak_os_free(mem, sz);
+            node = *(void* volatile*)slot;
+        }
+    }
+    return node;
+}
+
+/*!
+ * Get the value recorded for the page containing \p p. The page must have been recorded with
+ * \p ak_pagemap_set_range().
+ */
+ak_inline static ak_sz ak_pagemap_get(const void* p)
+{
+    const ak_sz key = ((ak_sz)p) >> AK_PAGEMAP_PAGE_BITS;
+    AKMALLOC_ASSERT((key >> (AK_PAGEMAP_MID_BITS + AK_PAGEMAP_LEAF_BITS)) < (AK_SZ_ONE << AK_PAGEMAP_TOP_BITS));
+    const ak_sz* leaf = AK_PAGEMAP[key >> (AK_PAGEMAP_MID_BITS + AK_PAGEMAP_LEAF_BITS)][(key >> AK_PAGEMAP_LEAF_BITS) & AK_PAGEMAP_MID_MASK];
+    AKMALLOC_ASSERT(leaf);
+    return leaf[key & AK_PAGEMAP_LEAF_MASK];
+}
+
+/*!
+ * Record \p v for all pages in [\p p, \p p + \p sz).
+ *
+ * \return \c 0 if memory for the map could not be obtained, else non-zero.
+ */
+static int ak_pagemap_set_range(const void* p, ak_sz sz, ak_sz v)
+{
+    const ak_sz first = ((ak_sz)p) >> AK_PAGEMAP_PAGE_BITS;
+    const ak_sz last = (((ak_sz)p) + sz - 1) >> AK_PAGEMAP_PAGE_BITS;
+    for (ak_sz key = first; key <= last; ++key) {
+        const ak_sz top = key >> (AK_PAGEMAP_MID_BITS + AK_PAGEMAP_LEAF_BITS);
+        AKMALLOC_ASSERT_ALWAYS(top < (AK_SZ_ONE << AK_PAGEMAP_TOP_BITS));
+        ak_sz** mid = (ak_sz**)ak_pagemap_new_node((void**)ak_as_ptr(AK_PAGEMAP[top]), sizeof(ak_sz*) << AK_PAGEMAP_MID_BITS);
+        if (ak_unlikely(!mid)) {
+            return 0;
+        }
+        ak_sz* leaf = (ak_sz*)ak_pagemap_new_node((void**)ak_as_ptr(mid[(key >> AK_PAGEMAP_LEAF_BITS) & AK_PAGEMAP_MID_MASK]), sizeof(ak_sz) << AK_PAGEMAP_LEAF_BITS);
+        if (ak_unlikely(!leaf)) {
+            return 0;
+        }
+        leaf[key & AK_PAGEMAP_LEAF_MASK] = v;
+    }
+    return 1;
+}
+
+#endif/*defined(AK_USE_PAGEMAP)*/
+/********************** page map end ************************/
+
+
 /********************** slab begin **********************/
 /*!
  *
@@ -1271,13 +1731,13 @@ typedef int(*ak_seg_cbk)(const void*, size_t);
  * Slabs are a concept borrowed from <a href="https://www.usenix.org/legacy/publications/library/proceedings/bos94/full_papers/bonwick.a">Jeff Bonwick's UseNIX paper </a> and adapted
  * as a general implementation scheme.
  *
- * The major departures from the scheme presented in Jeff's paper is that we don't keep the
+ * The major departures from the scheme presented in Bonwick's paper is that we don't keep the
  * client-specified object APIs because we are using slabs to implement the plain old \p libc
  * memory allocation routines which do not have this flexibility.
  *
  * Nevertheless, slabs prove to be efficient and compact for dealing with memory.
  *
- * Slabs are all page sized, and allocate a fixed size.
+ * Slabs are page sized by default, and allocate a fixed size.
  * They have a bit map at the head with some links to forward and back slabs.
  * The slab bit map knows which indexes of fixed size entries are free and which are allocated.
  * Allocating a new object is as simple as finding the first index of the unused bit in the
@@ -1289,9 +1749,9 @@ typedef int(*ak_seg_cbk)(const void*, size_t);
  * Slabs are held in chains with a root. This root has the meta data about the slab, like what
  * fixed size it is allocating, how often do we return slab pages to the OS etc.
  *
- * Slab roots have three lists of slabs
+ * Slab roots have three kinds of lists of slabs
  *
- * -# <em>Partial</em>: List of partially filled slabs.
+ * -# <em>Partial</em>: Lists of partially filled slabs, one for each range of occupancy.
  *
  * -# <em>Full</em>: List of completely full slabs.
  *
@@ -1299,14 +1759,45 @@ typedef int(*ak_seg_cbk)(const void*, size_t);
  *
  * This separation exists so that a slab root can get to an allocation in constant time by
  * only checking the partial bins. As they fill up, the slab is moved to the full bin. If
- * something in a full bin is freed, it is moved to the partial bin, and when all entries in
+ * something in a full bin is freed, it is moved to a partial bin, and when all entries in
  * a slab are free, it is moved to the empty bin.
  *
+ * Every slab counts its free objects, and partial slabs are kept in <tt>AK_SLAB_PARTIAL_BUCKETS</tt>
+ * bins by how many live objects they hold. Allocation takes from the fullest bin, so that
+ * sparsely used slabs are left alone to drain and reach the empty bin, from where they can be
+ * returned to the OS.
+ *
+ * As in J. Bonwick, <em>The Slab Allocator: An Object-Caching Kernel Memory Allocator</em>
+ * (USENIX Summer 1994), slabs are coloured: the bytes that the objects leave unused at the end of
+ * a slab are used to start the objects of successive slabs at different offsets, in steps of
+ * <tt>AK_SLAB_COLOUR_STEP</tt>. Objects at the same index in different slabs then map to
+ * different cache sets, instead of competing for the same ones. See \c bench/slab_colour.c.
+ *
+ * A root obtains one slab from the OS the first time, and twice as many at each later refill, up
+ * to a limit that grows with the slab size. The slabs of a refill are only formatted, and so
+ * only touched, when allocation first needs them, so a size that serves a handful of objects
+ * costs the process a single page.
+ *
  * When there are more than a user-settable number of empty slabs, the slab allocator will free
  * another user-settable number of them. The default is for both number to be equal, which means
  * every so often, a slab allocator will return all its free pages to the OS.
  *
+ * With <tt>AK_SLAB_SPANS</tt> a root can use slabs that span several pages, for sizes too large
+ * to fit enough objects in a page. The page map records the slab of every page, which is how
+ * an object finds the head of its slab when the slab is larger than a page.
+ *
  * This allocator can be made thread safe upon request.
+ *
+ * When it is, a thread that frees an object while another thread holds the root lock does not
+ * wait for it. The object is pushed onto a lock-free remote free list kept in its page, and the
+ * first such object also queues the page on the root. Whoever holds the lock next merges all
+ * queued objects into the page bitmaps in one pass.
+ *
+ * With <tt>AK_SLAB_LOCKFREE</tt> objects are claimed and returned with atomic operations on
+ * the bitmap words, and each page keeps an atomic count of free objects. The lock is only
+ * taken when that count says that a page must move between the partial, full and empty lists,
+ * or when there is no partial page left. Lock-free readers may look at any page the root ever
+ * owned, so in this mode pages are not returned to the OS until the root is destroyed.
  */
 
 typedef struct ak_slab_tag ak_slab;
@@ -1314,15 +1805,17 @@ typedef struct ak_slab_tag ak_slab;
 typedef struct ak_slab_root_tag ak_slab_root;
 
 #if defined(AK_SLAB_USE_LOCKS)
-#  define AK_SLAB_LOCK_DEFINE(nm)    ak_spinlock nm
-#  define AK_SLAB_LOCK_INIT(root)    ak_spinlock_init(ak_as_ptr((root)->LOCKED))
-#  define AK_SLAB_LOCK_ACQUIRE(root) ak_spinlock_acquire(ak_as_ptr((root)->LOCKED))
-#  define AK_SLAB_LOCK_RELEASE(root) ak_spinlock_release(ak_as_ptr((root)->LOCKED))
+#  define AK_SLAB_LOCK_DEFINE(nm)    ak_lock nm
+#  define AK_SLAB_LOCK_INIT(root)    ak_lock_init(ak_as_ptr((root)->LOCKED))
+#  define AK_SLAB_LOCK_ACQUIRE(root) ak_lock_acquire_if_needed(ak_as_ptr((root)->LOCKED))
+#  define AK_SLAB_LOCK_RELEASE(root) ak_lock_release_if_needed(ak_as_ptr((root)->LOCKED))
+#  define AK_SLAB_LOCK_TRY(root)     ak_lock_try_acquire_if_needed(ak_as_ptr((root)->LOCKED))
 #else
 #  define AK_SLAB_LOCK_DEFINE(nm)
 #  define AK_SLAB_LOCK_INIT(root)
 #  define AK_SLAB_LOCK_ACQUIRE(root)
 #  define AK_SLAB_LOCK_RELEASE(root)
+#  define AK_SLAB_LOCK_TRY(root)     1
 #endif
 
 struct ak_slab_tag
@@ -1331,28 +1824,62 @@ struct ak_slab_tag
     ak_slab*      bk;
     ak_slab_root* root;
     ak_bitset512  avail;
-    void*         _unused;
+    void*         rfree;            /**< objects freed while the root was locked, see ak_slab_free */
+    ak_slab*      rnext;            /**< next page in the root's remote queue */
+    ak_u32        nfree;            /**< number of free objects */
+    ak_u16        list;             /**< list the page is on, see ak_slab_list_for */
+    ak_u16        colour;           /**< offset of the first object from the end of the header */
 };
 
+/* number of partial lists of a root, which sort pages by the number of live objects */
+#if !defined(AK_SLAB_PARTIAL_BUCKETS)
+#  define AK_SLAB_PARTIAL_BUCKETS 4
+#endif
+
+#if AK_SLAB_PARTIAL_BUCKETS < 1 || AK_SLAB_PARTIAL_BUCKETS > 32
+#  error "AK_SLAB_PARTIAL_BUCKETS must be between 1 and 32."
+#endif
+
+/* lists in order of occupancy, partial lists are numbered from the emptiest */
+#define AK_SLAB_LIST_EMPTY   0
+#define AK_SLAB_LIST_PARTIAL 1
+#define AK_SLAB_LIST_FULL    (AK_SLAB_LIST_PARTIAL + AK_SLAB_PARTIAL_BUCKETS)
+
 /*!
  * Slab allocator
+ *
+ * The root is laid out so that roots next to each other share no cache line. The configuration
+ * is read mostly and comes first, the queue of remotely freed pages that contending threads write
+ * to is on the next line, and the lock starts the lines with the lists it protects.
  */
 struct ak_slab_root_tag
 {
     ak_u32 sz;                      /**< the size of elements in this slab */
-    ak_u32 npages;                  /**< number of pages to obtain from the OS */
+    ak_u32 spansz;                  /**< number of bytes in each slab, a multiple of the page size */
+    ak_u32 npages;                  /**< number of slabs to obtain from the OS at the next refill */
+    ak_u32 maxpages;                /**< largest number of slabs to obtain from the OS at once */
     ak_u32 navail;                  /**< max number of available bits for the slab size \p sz */
+    ak_u32 RELEASE_RATE;            /**< number of pages moved to empty before a release */
+    ak_u32 MAX_PAGES_TO_FREE;       /**< number of pages to free when release happens */
+    ak_u32 DEFER_RELEASE;           /**< leave releasing pages to the maintenance thread */
+    ak_u32 bucketmul;               /**< maps live objects to a partial list, see ak_slab_list_for */
+    ak_u32 maxcolour;               /**< largest object offset of a slab, see ak_slab_next_colour */
+
+    AK_CACHE_ALIGNED
+    ak_slab* REMOTE;                /**< pages with remotely freed objects to merge */
+
+    AK_CACHE_ALIGNED
     ak_u32 nempty;                  /**< number of empty pages */
     ak_u32 release;                 /**< number of accumulated free empty pages since last release */
-    ak_u32 _unused;                 /**< for alignment */
+    ak_u32 partial;                 /**< bit b is set when partial_root[b] has pages */
+    ak_u32 colour;                  /**< object offset of the next new slab */
+    ak_u32 nfresh;                  /**< number of slabs at \p fresh */
+    char* fresh;                    /**< slabs obtained from the OS that were never handed out */
+    AK_SLAB_LOCK_DEFINE(LOCKED);    /**< lock for this allocator if locks are enabled */
 
-    ak_slab partial_root;           /**< root of the partially filled slab list*/
+    ak_slab partial_root[AK_SLAB_PARTIAL_BUCKETS]; /**< roots of the partially filled slab lists, emptiest first */
     ak_slab full_root;              /**< root of the full slab list */
     ak_slab empty_root;             /**< root of the empty slab list */
-
-    ak_u32 RELEASE_RATE;            /**< number of pages moved to empty before a release */
-    ak_u32 MAX_PAGES_TO_FREE;       /**< number of pages to free when release happens */
-    AK_SLAB_LOCK_DEFINE(LOCKED);    /**< lock for this allocator if locks are enabled */
 };
 
 #if !defined(AK_SLAB_RELEASE_RATE)
@@ -1363,6 +1890,29 @@ struct ak_slab_root_tag
 #  define AK_SLAB_MAX_PAGES_TO_FREE AK_SLAB_RELEASE_RATE
 #endif
 
+/* distance between the object offsets of successive slabs, 0 to disable colouring */
+#if !defined(AK_SLAB_COLOUR_STEP)
+#  define AK_SLAB_COLOUR_STEP AKMALLOC_CACHE_LINE_LENGTH
+#endif
+
+#if (AK_SLAB_COLOUR_STEP % 16) != 0
+#  error "AK_SLAB_COLOUR_STEP must keep objects 16 byte aligned."
+#endif
+
+/* smallest number of bytes in a slab that spans several pages */
+#if !defined(AK_SLAB_SPAN_SIZE)
+#  define AK_SLAB_SPAN_SIZE (AK_SZ_ONE << 16) /* 64KB */
+#endif
+
+/* pages keep the NUMA node they were first placed on, so they are not shared across nodes */
+#if !defined(AK_SLAB_PAGE_DEPOT_SIZE)
+#  if AKMALLOC_NUMA
+#    define AK_SLAB_PAGE_DEPOT_SIZE 0
+#  else
+#    define AK_SLAB_PAGE_DEPOT_SIZE 256
+#  endif
+#endif
+
 /**************************************************************/
 /* P R I V A T E                                              */
 /**************************************************************/
@@ -1400,13 +1950,28 @@ struct ak_slab_root_tag
     ak_slab_link_fd(sL, fL);               \
   } while (0)
 
-ak_inline static void ak_slab_init_chain_head(ak_slab* s, ak_slab_root* rootp)
+/* the slab that the object p belongs to, only slabs of one page start at the page of p */
+#if defined(AK_SLAB_SPANS)
+#  define ak_slab_of(p) ((ak_slab*)(void*)(ak_pagemap_get((p)) & ~AK_PAGEMAP_SLAB))
+#else
+ak_inline static const void* ak_page_start_before_const(const void* p)
 {
-    s->fd = s->bk = s;
-    s->root = rootp;
-    ak_bitset512_clear_all(&(s->avail));
+    return (void*)((ak_sz)p & (~(ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1)));
+}
+
+#  define ak_slab_of(p) ((ak_slab*)(void*)ak_page_start_before_const((p)))
+#endif
+
+ak_inline static void ak_slab_init_chain_head(ak_slab* s, ak_slab_root* rootp)
+{
+    s->fd = s->bk = s;
+    s->root = rootp;
+    ak_bitset512_clear_all(&(s->avail));
+    s->rfree = AK_NULLPTR;
+    s->rnext = AK_NULLPTR;
 }
 
+/* the largest refill of a root of one page slabs */
 ak_inline static ak_sz ak_num_pages_for_sz(ak_sz sz)
 {
     return (sz)/4;
@@ -1420,7 +1985,6 @@ ak_inline static ak_sz ak_num_pages_for_sz(ak_sz sz)
     ak_slab_root* slabroot = (r);                                             \
                                                                               \
     AKMALLOC_ASSERT(slabmem);                                                 \
-    AKMALLOC_ASSERT(slabsz < (AKMALLOC_DEFAULT_PAGE_SIZE - sizeof(ak_slab))); \
     AKMALLOC_ASSERT(slabsz > 0);                                              \
     AKMALLOC_ASSERT(slabsz % 2 == 0);                                         \
                                                                               \
@@ -1430,42 +1994,48 @@ ak_inline static ak_sz ak_num_pages_for_sz(ak_sz sz)
     ak_slab* s = (ak_slab*)slabmem;                                           \
     s->fd = s->bk = AK_NULLPTR;                                               \
     s->root = slabroot;                                                       \
-    ak_bitset512_clear_all(&(s->avail));                                      \
-    int inavail = (int)slabnavail;                                            \
-    for (int i = 0; i < inavail; ++i) {                                       \
-        ak_bitset512_set(&(s->avail), i);                                     \
-    }                                                                         \
+    s->rfree = AK_NULLPTR;                                                    \
+    s->rnext = AK_NULLPTR;                                                    \
+    s->nfree = (ak_u32)slabnavail;                                            \
+    s->list = AK_SLAB_LIST_EMPTY;                                             \
+    s->colour = 0;                                                            \
+    ak_bitset512_set_first_n(&(s->avail), (int)slabnavail);                   \
     (void)slabsz;                                                             \
   } while (0)
 
+/*!
+ * The object offset of a new slab of \p root. Successive slabs cycle through the offsets that fit in
+ * the bytes their objects leave unused.
+ */
+ak_inline static ak_u16 ak_slab_next_colour(ak_slab_root* root)
+{
+    const ak_u32 colour = root->colour;
+    root->colour = (colour + AK_SLAB_COLOUR_STEP > root->maxcolour) ? 0 : (colour + AK_SLAB_COLOUR_STEP);
+    return (ak_u16)colour;
+}
+
 ak_inline static ak_slab* ak_slab_new_init(char* mem, ak_sz sz, ak_sz navail, ak_slab* fd, ak_slab* bk, ak_slab_root* root)
 {
     ak_slab_init(mem, sz, navail, root);
     ak_slab* slab = ak_ptr_cast(ak_slab, mem);
+    slab->colour = ak_slab_next_colour(root);
     ak_slab_link(slab, fd, bk);
     return slab;
 }
 
-static ak_slab* ak_slab_new_alloc(ak_sz sz, ak_slab* fd, ak_slab* bk, ak_slab_root* root)
+static ak_slab* ak_slab_new_alloc(char* const mem, int NPAGES, ak_sz sz, ak_slab* fd, ak_slab* bk, ak_slab_root* root)
 {
-    const int NPAGES = root->npages;
-
-    // try to acquire a page and fit as many slabs as possible in
-    char* const mem = (char*)ak_os_alloc(NPAGES * AKMALLOC_DEFAULT_PAGE_SIZE);
-    {// return if no mem
-        if (ak_unlikely(!mem)) { return AK_NULLPTR; }
-    }
-
+    // fit as many slabs as possible in pages mapped by the caller
     ak_sz navail = root->navail;
 
     char* cmem = mem;
     for (int i = 0; i < NPAGES - 1; ++i) {
-        ak_slab* nextpage = ak_ptr_cast(ak_slab, (cmem + AKMALLOC_DEFAULT_PAGE_SIZE));
+        ak_slab* nextpage = ak_ptr_cast(ak_slab, (cmem + root->spansz));
         ak_slab* curr = ak_slab_new_init(cmem, sz, navail, nextpage, bk, root);
         AKMALLOC_ASSERT(ak_bitset512_num_trailing_ones(&(curr->avail)) == (int)navail);
         (void)curr;
         bk = nextpage;
-        cmem += AKMALLOC_DEFAULT_PAGE_SIZE;
+        cmem += root->spansz;
     }
 
     ak_slab_new_init(cmem, sz, navail, fd, bk, root);
@@ -1473,74 +2043,185 @@ static ak_slab* ak_slab_new_alloc(ak_sz sz, ak_slab* fd, ak_slab* bk, ak_slab_ro
     return ak_ptr_cast(ak_slab, mem);
 }
 
-static ak_slab* ak_slab_new_reuse(ak_sz sz, ak_slab* fd, ak_slab* bk, ak_slab_root* root)
+/*!
+ * Add pages that were mapped without the lock to the root, with the lock held. They are left
+ * unformatted until allocation needs them, see ak_slab_take_fresh. If another thread refilled the
+ * root in the meantime and its pages are still unused, these are formatted as empty pages instead.
+ * Each refill that the root needed doubles the next one, up to \p maxpages.
+ * \param root; Pointer to the allocator root
+ * \param mem; The pages
+ * \param npages; Number of slabs at \p mem
+ */
+static void ak_slab_add_pages(ak_slab_root* root, char* mem, ak_u32 npages)
 {
-    AKMALLOC_ASSERT(root->nempty >= 1);
-
-    ak_sz navail = root->navail;
-    ak_slab* const curr = root->empty_root.fd;
-    ak_slab_unlink(curr);
-    ak_slab_new_init((char*)curr, sz, navail, fd, bk, root);
-
-    --(root->nempty);
+    if (npages >= root->npages) {
+        root->npages = (root->npages > (root->maxpages / 2)) ? root->maxpages : (root->npages * 2);
+    }
+    if (ak_likely(root->nfresh == 0)) {
+        root->fresh = mem;
+        root->nfresh = npages;
+    } else {
+        ak_slab_new_alloc(mem, (int)npages, root->sz, root->empty_root.fd, &(root->empty_root), root);
+        root->nempty += npages;
+    }
+}
 
-    return curr;
+/*!
+ * Format the next slab that was never handed out as an empty page, with the lock held.
+ * \param root; Pointer to the allocator root
+ *
+ * \return \c 0 if there is none, else the page.
+ */
+static ak_slab* ak_slab_take_fresh(ak_slab_root* root)
+{
+    if (ak_unlikely(root->nfresh == 0)) {
+        return AK_NULLPTR;
+    }
+    char* const mem = root->fresh;
+    root->fresh += root->spansz;
+    --(root->nfresh);
+    ++(root->nempty);
+    return ak_slab_new_init(mem, root->sz, root->navail, root->empty_root.fd, &(root->empty_root), root);
 }
 
-ak_inline static ak_slab* ak_slab_new(ak_sz sz, ak_slab* fd, ak_slab* bk, ak_slab_root* root)
+/*!
+ * The list for a page with \p nfree free objects. Partial pages are spread over the partial lists
+ * by their number of live objects, \p bucketmul is a fixed point reciprocal of \p navail that
+ * keeps a division off the allocation path.
+ */
+ak_inline static ak_u32 ak_slab_list_for(const ak_slab_root* root, ak_u32 nfree)
 {
-    return (root->nempty > 0)
-                ? ak_slab_new_reuse(sz, fd, bk, root)
-                : ak_slab_new_alloc(sz, fd, bk, root);
+    if (nfree == 0) {
+        return AK_SLAB_LIST_FULL;
+    }
+    if (nfree == root->navail) {
+        return AK_SLAB_LIST_EMPTY;
+    }
+    return AK_SLAB_LIST_PARTIAL + (((root->navail - nfree) * root->bucketmul) >> 16);
 }
 
-#define ak_slab_2_mem(s) (char*)(void*)((s) + 1)
+ak_inline static ak_slab* ak_slab_list_head(ak_slab_root* root, ak_u32 list)
+{
+    if (list == AK_SLAB_LIST_EMPTY) {
+        return &(root->empty_root);
+    }
+    if (list == AK_SLAB_LIST_FULL) {
+        return &(root->full_root);
+    }
+    return &(root->partial_root[list - AK_SLAB_LIST_PARTIAL]);
+}
 
-ak_inline static int ak_slab_all_free(ak_slab* s)
+/*!
+ * Move a page to the list \p list, with the lock held. Pages that fill up go to the front of
+ * their new list so that allocation stays on them, pages that drain go to the back.
+ * \param root; Pointer to the allocator root that owns \p slab
+ * \param slab; The page
+ * \param list; The list to move it to
+ */
+static void ak_slab_move(ak_slab_root* root, ak_slab* slab, ak_u32 list)
 {
-    const ak_bitset512* pavail = &(s->avail);
-    ak_u32 nto;
-    ak_bitset512_fill_num_trailing_ones(pavail, nto);
-    return nto == s->root->navail;
+    const ak_u32 old = slab->list;
+    AKMALLOC_ASSERT(old != list);
+
+    ak_slab_unlink(slab);
+    if (old == AK_SLAB_LIST_EMPTY) {
+        --(root->nempty);
+    } else if (old != AK_SLAB_LIST_FULL) {
+        const ak_slab* const oldhead = ak_slab_list_head(root, old);
+        if (oldhead->fd == oldhead) {
+            root->partial &= ~(((ak_u32)1) << (old - AK_SLAB_LIST_PARTIAL));
+        }
+    }
+
+    ak_slab* const head = ak_slab_list_head(root, list);
+    if (list == AK_SLAB_LIST_EMPTY) {
+        ak_slab_link(slab, head->fd, head);
+        // pages are returned to the OS after the lock is released, see ak_slab_release_if_due
+        ++(root->nempty); ++(root->release);
+    } else if ((list == AK_SLAB_LIST_FULL) || (list > old)) {
+        ak_slab_link(slab, head->fd, head);
+    } else {
+        ak_slab_link(slab, head, head->bk);
+    }
+    if ((list != AK_SLAB_LIST_EMPTY) && (list != AK_SLAB_LIST_FULL)) {
+        root->partial |= ((ak_u32)1) << (list - AK_SLAB_LIST_PARTIAL);
+    }
+    slab->list = (ak_u16)list;
 }
 
-ak_inline static int ak_slab_none_free(ak_slab* s)
+/*!
+ * Move a page to the list that matches its number of free objects, with the lock held.
+ * \param root; Pointer to the allocator root that owns \p slab
+ * \param slab; The page
+ */
+ak_inline static void ak_slab_relink(ak_slab_root* root, ak_slab* slab)
 {
-    const ak_bitset512* pavail = &(s->avail);
-    int ntz;
-    ak_bitset512_fill_num_trailing_zeros(pavail, ntz);
-    return ntz == 512;
+    const ak_u32 list = ak_slab_list_for(root, slab->nfree);
+    if (list != slab->list) {
+        ak_slab_move(root, slab, list);
+    }
 }
 
-static void* ak_slab_search(ak_slab* s, ak_sz sz, ak_u32 navail, ak_slab** pslab, int* pntz)
+/*!
+ * The page to allocate from next with the lock held: the first page of the fullest partial list,
+ * or an empty page if there is no partial page, formatting one if needed.
+ *
+ * \return \c 0 if the root has no free objects, else the page.
+ */
+ak_inline static ak_slab* ak_slab_alloc_page(ak_slab_root* root)
 {
-    const ak_slab* const root = s;
-    void* mem = AK_NULLPTR;
-    if (ak_likely(s->fd != root)) {
-        AKMALLOC_ASSERT(pslab);
-        AKMALLOC_ASSERT(pntz);
-        s = s->fd;
+    const ak_bitset32 mask = root->partial;
+    if (ak_likely(mask)) {
+        int nlz;
+        ak_bitset_fill_num_leading_zeros(&mask, nlz);
+        return root->partial_root[31 - nlz].fd;
+    }
+    return (root->nempty > 0) ? root->empty_root.fd : ak_slab_take_fresh(root);
+}
 
-        // partial list entry must not be full
-        AKMALLOC_ASSERT(ak_bitset512_num_trailing_zeros(&(s->avail)) != 512);
+#define ak_slab_2_mem(s) ((char*)(void*)((s) + 1) + (s)->colour)
 
-        const ak_bitset512* pavail = &(s->avail);
-        int ntz;
-        ak_bitset512_fill_num_trailing_zeros(pavail, ntz);
+/* the 64 bit word of the bitset holding bit idx */
+#define ak_slab_avail_word(s, idx) (ak_as_ptr(ak_bitset512_word(&((s)->avail), (idx))))
 
-        AKMALLOC_ASSERT(ak_bitset512_get(&(s->avail), ntz));
-        ak_bitset512_clear(&(s->avail), ntz);
-        mem = ak_slab_2_mem(s) + (ntz * sz);
+/*!
+ * Take the lowest free object of a page that has one, with the lock held. The page is not moved
+ * between lists.
+ * \param s; The page
+ * \param sz; The object size
+ *
+ * \return The object.
+ */
+ak_inline static void* ak_slab_search(ak_slab* s, ak_sz sz)
+{
+    AKMALLOC_ASSERT(s->nfree > 0);
+    AKMALLOC_ASSERT(ak_bitset512_any(&(s->avail)));
 
-        *pslab = s;
-        if (ntz == (int)navail - 1) {
-            ntz = 512;
-        } else {
-            ak_bitset512_fill_num_trailing_zeros(pavail, ntz);
-        }
-        *pntz = ntz;
+    ak_bitset64* a = s->avail.a;
+    int w = 0;
+    while (!a[w]) {
+        ++w;
     }
-    return mem;
+    int b;
+    ak_bitset64_fill_num_trailing_zeros(&(a[w]), b);
+    a[w] &= (a[w] - 1);
+    --(s->nfree);
+
+    const int idx = (w << 6) + b;
+    return ak_slab_2_mem(s) + (idx * sz);
+}
+
+/*!
+ * Return a slab to the OS, forgetting its pages in the page map first.
+ * \param page; The slab
+ * \param sz; Number of bytes in the slab
+ */
+ak_inline static void ak_slab_free_page(void* page, ak_sz sz)
+{
+#if defined(AK_SLAB_HEADERLESS)
+    ak_pagemap_set_range(page, sz, 0);
+#endif
+    ak_os_free(page, sz);
 }
 
 static void ak_slab_release_pages(ak_slab_root* root, ak_slab* s, ak_u32 numtofree)
@@ -1555,51 +2236,322 @@ static void ak_slab_release_pages(ak_slab_root* root, ak_slab* s, ak_u32 numtofr
             next = s->fd;
         }
         ak_slab_unlink(s);
-        ak_os_free(s, AKMALLOC_DEFAULT_PAGE_SIZE);
+        ak_slab_free_page(s, root->spansz);
         s = next;
     }
 }
 
-ak_inline static void ak_slab_release_os_mem(ak_slab_root* root)
+/*!
+ * Return the slabs that were never handed out to the OS. They are detached under the lock and
+ * returned to the OS after it is released.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_slab_release_fresh(ak_slab_root* root)
 {
-    ak_u32 numtofree = root->nempty;
-    numtofree = (numtofree > root->MAX_PAGES_TO_FREE)
-                    ? root->MAX_PAGES_TO_FREE
-                    : numtofree;
-    ak_slab_release_pages(root, &(root->empty_root), numtofree);
-    root->nempty -= numtofree;
-    root->release = 0;
+    AK_SLAB_LOCK_ACQUIRE(root);
+    char* const fresh = root->fresh;
+    const ak_u32 nfresh = root->nfresh;
+    root->fresh = AK_NULLPTR;
+    root->nfresh = 0;
+    AK_SLAB_LOCK_RELEASE(root);
+
+    if (nfresh) {
+        ak_slab_free_page(fresh, (ak_sz)nfresh * root->spansz);
+    }
+}
+
+/*
+ * Every slab of one page has the same size whatever its slab size, so the pages released by one
+ * root are kept in a depot shared by all such roots of all allocators and reformatted by the next
+ * root that needs a page, before anything is returned to or obtained from the OS. The depot is an array of
+ * slots that are claimed and emptied with compare and swap, so a page that is taken and put back
+ * in the meantime cannot be handed out twice.
+ */
+#if AK_SLAB_PAGE_DEPOT_SIZE > 0
+
+static void* volatile AK_SLAB_PAGE_DEPOT[AK_SLAB_PAGE_DEPOT_SIZE];
+static ak_u32 AK_SLAB_PAGE_DEPOT_COUNT = 0;
+
+/*!
+ * Put an empty page in the depot.
+ * \param page; The page
+ *
+ * \return \c 0 if the depot is full, else non-zero.
+ */
+static int ak_slab_depot_put(void* page)
+{
+    if (*(volatile ak_u32*)ak_as_ptr(AK_SLAB_PAGE_DEPOT_COUNT) >= AK_SLAB_PAGE_DEPOT_SIZE) {
+        return 0;
+    }
+    for (ak_u32 i = 0; i < AK_SLAB_PAGE_DEPOT_SIZE; ++i) {
+        if (!AK_SLAB_PAGE_DEPOT[i] && ak_atomic_cas_ptr(ak_as_ptr(AK_SLAB_PAGE_DEPOT[i]), page, AK_NULLPTR)) {
+            ak_atomic_fetch_add(ak_as_ptr(AK_SLAB_PAGE_DEPOT_COUNT), 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * Take a page from the depot.
+ *
+ * \return \c 0 if the depot is empty, else the page.
+ */
+static void* ak_slab_depot_get()
+{
+    if (!*(volatile ak_u32*)ak_as_ptr(AK_SLAB_PAGE_DEPOT_COUNT)) {
+        return AK_NULLPTR;
+    }
+    for (ak_u32 i = 0; i < AK_SLAB_PAGE_DEPOT_SIZE; ++i) {
+        void* page = AK_SLAB_PAGE_DEPOT[i];
+        if (page && ak_atomic_cas_ptr(ak_as_ptr(AK_SLAB_PAGE_DEPOT[i]), AK_NULLPTR, page)) {
+            ak_atomic_fetch_add(ak_as_ptr(AK_SLAB_PAGE_DEPOT_COUNT), (ak_u32)0 - 1);
+            return page;
+        }
+    }
+    return AK_NULLPTR;
+}
+
+/*!
+ * Return all pages in the depot to the OS.
+ */
+static void ak_slab_depot_release()
+{
+    void* page;
+    while ((page = ak_slab_depot_get()) != AK_NULLPTR) {
+        ak_slab_free_page(page, AKMALLOC_DEFAULT_PAGE_SIZE);
+    }
+}
+
+#else
+#  define ak_slab_depot_put(page) 0
+#  define ak_slab_depot_get() AK_NULLPTR
+#  define ak_slab_depot_release()
+#endif
+
+/*!
+ * Obtain slabs to refill the root with, without the lock. For slabs of one page, a page from the
+ * depot is preferred to mapping new ones. With \p AK_SLAB_HEADERLESS every page is recorded in the
+ * page map as belonging to its slab.
+ * \param root; Pointer to the allocator root
+ * \param pnpages; Set to the number of slabs obtained
+ *
+ * \return \c 0 on failure, else the slabs.
+ */
+static char* ak_slab_get_pages(ak_slab_root* root, ak_u32* pnpages)
+{
+    const ak_sz spansz = root->spansz;
+    ak_u32 npages = 1;
+    char* pages = (spansz == AKMALLOC_DEFAULT_PAGE_SIZE) ? (char*)ak_slab_depot_get() : AK_NULLPTR;
+    if (!pages) {
+        npages = root->npages;
+        pages = (char*)ak_os_alloc(npages * spansz);
+    }
+#if defined(AK_SLAB_HEADERLESS)
+    for (ak_u32 i = 0; ak_likely(pages) && (i < npages); ++i) {
+        char* const slab = pages + (i * spansz);
+        if (ak_unlikely(!ak_pagemap_set_range(slab, spansz, ((ak_sz)slab) | AK_PAGEMAP_SLAB))) {
+            ak_os_free(pages, npages * spansz);
+            pages = AK_NULLPTR;
+        }
+    }
+#endif
+    *pnpages = npages;
+    return pages;
+}
+
+#if defined(AK_SLAB_LOCKFREE)
+
+#if !defined(AK_SLAB_USE_LOCKS)
+#  error "AK_SLAB_LOCKFREE requires AK_SLAB_USE_LOCKS."
+#endif
+
+/*!
+ * Move a page to the list that matches its current free count. Must be called with the lock
+ * held, by every thread whose atomic update crossed a list boundary.
+ */
+static void ak_slab_lockfree_relink(ak_slab_root* root, ak_slab* slab)
+{
+    const ak_u32 list = ak_slab_list_for(root, *(volatile ak_u32*)ak_as_ptr(slab->nfree));
+    if (list != slab->list) {
+        ak_slab_move(root, slab, list);
+    }
+}
+
+/* whether going from nfree \p n0 to \p n1 moves a page to another list */
+#define ak_slab_lockfree_crosses(root, n0, n1) \
+  (ak_slab_list_for((root), (n0)) != ak_slab_list_for((root), (n1)))
+
+#define ak_slab_lockfree_relink_if(root, slab, cond) \
+  do {                                               \
+    if (ak_unlikely(cond)) {                         \
+        AK_SLAB_LOCK_ACQUIRE(root);                  \
+        ak_slab_lockfree_relink((root), (slab));     \
+        AK_SLAB_LOCK_RELEASE(root);                  \
+    }                                                \
+  } while (0)
+
+/*!
+ * Make sure there is a page on a partial list. Must be called with the lock held.
+ * \return \c 0 if no memory is available.
+ */
+static int ak_slab_lockfree_ensure_partial(ak_slab_root* root)
+{
+    if (root->partial) {
+        return 1;
+    }
+    if ((root->nempty > 0) || ak_slab_take_fresh(root)) {
+        // empty pages still have all their bits set
+        ak_slab_move(root, root->empty_root.fd, AK_SLAB_LIST_PARTIAL);
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+ * Claim a set bit in the page bitmap. The caller must have reserved one through \p nfree, so
+ * there is always a bit left for it.
+ */
+static int ak_slab_lockfree_claim(ak_slab* slab)
+{
+    for (;;) {
+        for (int w = 0; w < AK_BITSET512_WORDS; ++w) {
+            ak_bitset64* pw = ak_slab_avail_word(slab, w << 6);
+            ak_bitset64 v = *(volatile ak_bitset64*)pw;
+            while (v) {
+                int b;
+                ak_bitset64_fill_num_trailing_zeros(&v, b);
+                if (ak_atomic_cas64(pw, v & (v - 1), v)) {
+                    return (w << 6) + b;
+                }
+                v = *(volatile ak_bitset64*)pw;
+            }
+        }
+    }
+}
+
+static void* ak_slab_alloc_lockfree(ak_slab_root* root)
+{
+    for (;;) {
+        const ak_bitset32 mask = *(volatile ak_u32*)ak_as_ptr(root->partial);
+        if (ak_unlikely(!mask)) {
+            AK_SLAB_LOCK_ACQUIRE(root);
+            int ok = ak_slab_lockfree_ensure_partial(root);
+            AK_SLAB_LOCK_RELEASE(root);
+            if (ak_unlikely(!ok)) {
+                ak_u32 npages;
+                char* pages = ak_slab_get_pages(root, &npages);
+                if (ak_unlikely(!pages)) {
+                    return AK_NULLPTR;
+                }
+                AK_SLAB_LOCK_ACQUIRE(root);
+                ak_slab_add_pages(root, pages, npages);
+                AK_SLAB_LOCK_RELEASE(root);
+            }
+            continue;
+        }
+
+        // the fullest partial list, which may have been emptied since the mask was read
+        int nlz;
+        ak_bitset_fill_num_leading_zeros(&mask, nlz);
+        ak_slab* const head = &(root->partial_root[31 - nlz]);
+        ak_slab* slab = *(ak_slab* volatile*)ak_as_ptr(head->fd);
+        if (ak_unlikely(slab == head)) {
+            continue;
+        }
+
+        // reserve an object, the page may have moved lists since it was read
+        ak_u32 n = *(volatile ak_u32*)ak_as_ptr(slab->nfree);
+        while (n > 0 && !ak_atomic_cas(ak_as_ptr(slab->nfree), n - 1, n)) {
+            n = *(volatile ak_u32*)ak_as_ptr(slab->nfree);
+        }
+        if (ak_unlikely(n == 0)) {
+            ak_slab_lockfree_relink_if(root, slab, 1);
+            continue;
+        }
+
+        int idx = ak_slab_lockfree_claim(slab);
+        ak_slab_lockfree_relink_if(root, slab, ak_slab_lockfree_crosses(root, n, n - 1));
+        return ak_slab_2_mem(slab) + (idx * root->sz);
+    }
+}
+
+static void ak_slab_free_lockfree(void* p)
+{
+    ak_slab* slab = ak_slab_of(p);
+    ak_slab_root* root = slab->root;
+    AKMALLOC_ASSERT(root);
+
+    int idx = (int)((char*)p - (char*)ak_slab_2_mem(slab))/(int)root->sz;
+    ak_bitset64* pw = ak_slab_avail_word(slab, idx);
+    const ak_bitset64 mask = ak_bitset512_mask(idx);
+    ak_bitset64 v;
+    do {
+        v = *(volatile ak_bitset64*)pw;
+        AKMALLOC_ASSERT(!(v & mask));
+    } while (!ak_atomic_cas64(pw, v | mask, v));
+
+    // the bit is visible before the count that allows reserving it
+    const ak_u32 n = ak_atomic_fetch_add(ak_as_ptr(slab->nfree), 1) + 1;
+    ak_slab_lockfree_relink_if(root, slab, ak_slab_lockfree_crosses(root, n - 1, n));
 }
 
+#endif/*defined(AK_SLAB_LOCKFREE)*/
+
 /**************************************************************/
 /* P U B L I C                                                */
 /**************************************************************/
 
 /*!
- * Initialize a slab allocator.
- * \param s; Pointer to the allocator root to initialize (non-NULL)
- * \param sz; Size of the slab elements (maximum allowed is 4000)
- * \param npages; Number of pages to allocate from the OS at once.
- * \param relrate; Release rate, \ref akmallocDox
- * \param maxpagefree; Number of segments to free upon release, \ref akmallocDox
+ * Initialize a slab allocator whose slabs are \p spansz bytes.
  */
-static void ak_slab_init_root(ak_slab_root* s, ak_sz sz, ak_u32 npages, ak_u32 relrate, ak_u32 maxpagefree)
+static void ak_slab_init_root_spansz(ak_slab_root* s, ak_sz sz, ak_u32 spansz, ak_u32 npages, ak_u32 relrate, ak_u32 maxpagefree)
 {
     s->sz = (ak_u32)sz;
-    s->navail = (ak_u32)(AKMALLOC_DEFAULT_PAGE_SIZE - sizeof(ak_slab))/(ak_u32)sz;
-    s->npages = npages;
+    s->spansz = spansz;
+    s->navail = (ak_u32)(spansz - sizeof(ak_slab))/(ak_u32)sz;
+    s->npages = 1;
+    s->maxpages = (npages > 0) ? npages : 1;
+    s->bucketmul = (ak_u32)(((ak_u32)AK_SLAB_PARTIAL_BUCKETS << 16) / s->navail);
+#if AK_SLAB_COLOUR_STEP > 0
+    const ak_u32 unused = spansz - (ak_u32)sizeof(ak_slab) - (s->navail * s->sz);
+    s->maxcolour = (unused / AK_SLAB_COLOUR_STEP) * AK_SLAB_COLOUR_STEP;
+#else
+    s->maxcolour = 0;
+#endif
     s->nempty = 0;
     s->release = 0;
+    s->partial = 0;
+    s->colour = 0;
+    s->nfresh = 0;
+    s->fresh = AK_NULLPTR;
 
-    ak_slab_init_chain_head(&(s->partial_root), s);
+    for (int i = 0; i < AK_SLAB_PARTIAL_BUCKETS; ++i) {
+        ak_slab_init_chain_head(&(s->partial_root[i]), s);
+    }
     ak_slab_init_chain_head(&(s->full_root), s);
     ak_slab_init_chain_head(&(s->empty_root), s);
 
     s->RELEASE_RATE = relrate;
     s->MAX_PAGES_TO_FREE = maxpagefree;
+    s->DEFER_RELEASE = 0;
+    s->REMOTE = AK_NULLPTR;
     AK_SLAB_LOCK_INIT(s);
 }
 
+/*!
+ * Initialize a slab allocator.
+ * \param s; Pointer to the allocator root to initialize (non-NULL)
+ * \param sz; Size of the slab elements (maximum allowed is 4000)
+ * \param npages; Largest number of pages to allocate from the OS at once.
+ * \param relrate; Release rate, \ref akmallocDox
+ * \param maxpagefree; Number of segments to free upon release, \ref akmallocDox
+ */
+static void ak_slab_init_root(ak_slab_root* s, ak_sz sz, ak_u32 npages, ak_u32 relrate, ak_u32 maxpagefree)
+{
+    ak_slab_init_root_spansz(s, sz, AKMALLOC_DEFAULT_PAGE_SIZE, npages, relrate, maxpagefree);
+}
+
 /*!
  * Default initialize a slab allocator.
  * \param s; Pointer to the allocator root to initialize (non-NULL)
@@ -1610,94 +2562,431 @@ ak_inline static void ak_slab_init_root_default(ak_slab_root* s, ak_sz sz)
     ak_slab_init_root(s, sz, (ak_u32)ak_num_pages_for_sz(sz), (ak_u32)(AK_SLAB_RELEASE_RATE), (ak_u32)(AK_SLAB_MAX_PAGES_TO_FREE));
 }
 
+#if defined(AK_SLAB_SPANS)
 /*!
- * Attempt to allocate memory from the slab allocator root.
- * \param root; Pointer to the allocator root
- *
- * \return \c 0 on failure, else pointer to at least \p root->sz bytes of memory.
+ * Number of pages in a slab of objects of size \p sz. Slabs are at least \p AK_SLAB_SPAN_SIZE
+ * bytes, hold at least four objects, and are grown by up to a quarter when that wastes fewer bytes
+ * at their end.
  */
-ak_inline static void* ak_slab_alloc(ak_slab_root* root)
+static ak_u32 ak_slab_span_pages_for_sz(ak_sz sz)
 {
-    int ntz = 0;
-    ak_slab* slab = AK_NULLPTR;
-
-    AK_SLAB_LOCK_ACQUIRE(root);
-    const ak_sz sz = root->sz;
-
-    void* mem = ak_slab_search(&(root->partial_root), sz, root->navail, &slab, &ntz);
-
-    if (ak_unlikely(!mem)) {
-        slab = ak_slab_new(sz, root->partial_root.fd, &(root->partial_root), root);
-        if (ak_likely(slab)) {
-            AKMALLOC_ASSERT(ak_bitset512_get(&(slab->avail), 0));
-            ak_bitset512_clear(&(slab->avail), 0);
-            mem = ak_slab_2_mem(slab);
+    const ak_sz minsz = ((4 * sz + sizeof(ak_slab)) > AK_SLAB_SPAN_SIZE) ? (4 * sz + sizeof(ak_slab)) : AK_SLAB_SPAN_SIZE;
+    const ak_u32 minpages = (ak_u32)((minsz + AKMALLOC_DEFAULT_PAGE_SIZE - 1) / AKMALLOC_DEFAULT_PAGE_SIZE);
+    ak_u32 best = minpages;
+    ak_sz bestwaste = AK_SZ_MAX;
+    for (ak_u32 np = minpages; np <= minpages + (minpages / 4); ++np) {
+        const ak_sz spansz = np * AKMALLOC_DEFAULT_PAGE_SIZE;
+        const ak_sz navail = (spansz - sizeof(ak_slab)) / sz;
+        if (navail >= 512) {
+            break;
+        }
+        // compare the wasted fraction of both slabs
+        const ak_sz waste = spansz - (navail * sz);
+        if ((bestwaste == AK_SZ_MAX) || ((waste * best) < (bestwaste * np))) {
+            best = np;
+            bestwaste = waste;
         }
-    } else if (ak_unlikely(ntz == 512)) {
-        ak_slab_unlink(slab);
-        ak_slab_link(slab, root->full_root.fd, &(root->full_root));
     }
+    return best;
+}
 
-    AK_SLAB_LOCK_RELEASE(root);
-
-    return mem;
+/*!
+ * Initialize a slab allocator whose slabs span several pages. It obtains one slab from the OS at
+ * once and keeps about as many bytes in empty slabs as ak_slab_init_root_default() does in empty
+ * pages.
+ * \param s; Pointer to the allocator root to initialize (non-NULL)
+ * \param sz; Size of the slab elements
+ */
+static void ak_slab_init_root_span(ak_slab_root* s, ak_sz sz)
+{
+    const ak_u32 spansz = ak_slab_span_pages_for_sz(sz) * AKMALLOC_DEFAULT_PAGE_SIZE;
+    const ak_u32 ratio = spansz / AKMALLOC_DEFAULT_PAGE_SIZE;
+    const ak_u32 relrate = ((ak_u32)(AK_SLAB_RELEASE_RATE) / ratio) ? ((ak_u32)(AK_SLAB_RELEASE_RATE) / ratio) : 1;
+    const ak_u32 maxfree = ((ak_u32)(AK_SLAB_MAX_PAGES_TO_FREE) / ratio) ? ((ak_u32)(AK_SLAB_MAX_PAGES_TO_FREE) / ratio) : 1;
+    ak_slab_init_root_spansz(s, sz, spansz, 1, relrate, maxfree);
+    AKMALLOC_ASSERT(s->navail >= 4 && s->navail < 512);
 }
+#endif
 
 /*!
- * Return memory to the slab allocator root.
+ * Mark an object of a slab page as free with the lock held. The page is not moved between lists.
+ * \param root; Pointer to the allocator root that owns \p slab
+ * \param slab; The page that \p p belongs to
  * \param p; Pointer to the memory to return.
  */
-ak_inline static void ak_slab_free(void* p)
+ak_inline static void ak_slab_mark_free(ak_slab_root* root, ak_slab* slab, void* p)
 {
-    char* mem = (char*)p;
-
-    // round to page
-    ak_slab* slab = (ak_slab*)(ak_page_start_before(p));
-    AKMALLOC_ASSERT(slab->root);
+    AKMALLOC_ASSERT(slab->root == root);
+    AKMALLOC_ASSERT(ak_slab_of(p) == slab);
 
-    ak_slab_root* root = slab->root;
-    AK_SLAB_LOCK_ACQUIRE(root);
+    int idx = (int)((char*)p - (char*)ak_slab_2_mem(slab))/(int)root->sz;
+    AKMALLOC_ASSERT(!ak_bitset512_get(&(slab->avail), idx));
+    *ak_slab_avail_word(slab, idx) |= ak_bitset512_mask(idx);
+    ++(slab->nfree);
+}
 
-    int movetopartial = ak_slab_none_free(slab);
-    const ak_sz sz = root->sz;
+/*!
+ * Return memory to the slab allocator root with the lock held.
+ * \param root; Pointer to the allocator root that owns \p p
+ * \param p; Pointer to the memory to return.
+ */
+ak_inline static void ak_slab_free_locked(ak_slab_root* root, void* p)
+{
+    ak_slab* slab = ak_slab_of(p);
+    ak_slab_mark_free(root, slab, p);
+    ak_slab_relink(root, slab);
+}
 
-    int idx = (int)(mem - (char*)ak_slab_2_mem(slab))/(int)sz;
-    AKMALLOC_ASSERT(!ak_bitset512_get(&(slab->avail), idx));
-    ak_bitset512_set(&(slab->avail), idx);
-
-    if (ak_unlikely(movetopartial)) {
-        // put at the back of the partial list so the full ones
-        // appear at the front
-        ak_slab_unlink(slab);
-        ak_slab_link(slab, &(root->partial_root), root->partial_root.bk);
-    } else if (ak_unlikely(ak_slab_all_free(slab))) {
-        ak_slab_unlink(slab);
-        ak_slab_link(slab, root->empty_root.fd, &(root->empty_root));
-        ++(root->nempty); ++(root->release);
-        if (root->release >= root->RELEASE_RATE) {
-            ak_slab_release_os_mem(root);
-        }
+/*!
+ * Queue memory freed while the root lock is held by another thread. The object is pushed on
+ * the remote free list of its page, and the page is queued on the root if the list was empty.
+ * \param root; Pointer to the allocator root that owns \p p
+ * \param p; Pointer to the memory to return.
+ */
+static void ak_slab_free_remote(ak_slab_root* root, void* p)
+{
+    ak_slab* slab = ak_slab_of(p);
+    void* head;
+    do {
+        head = *(void* volatile*)ak_as_ptr(slab->rfree);
+        *(void**)p = head;
+    } while (!ak_atomic_cas_ptr(ak_as_ptr(slab->rfree), p, head));
+
+    if (!head) {
+        // first remote free on this page since the last merge, the page stays alive until
+        // the lock holder merges it, since p is not free yet
+        ak_slab* rhead;
+        do {
+            rhead = *(ak_slab* volatile*)ak_as_ptr(root->REMOTE);
+            slab->rnext = rhead;
+        } while (!ak_atomic_cas_ptr(ak_as_ptr(root->REMOTE), slab, rhead));
     }
-
-    AK_SLAB_LOCK_RELEASE(root);
 }
 
 /*!
- * Destroy the slab allocator root and return all memory to the OS.
+ * Merge all remotely freed objects into their pages. Must be called with the lock held.
  * \param root; Pointer to the allocator root
  */
-static void ak_slab_destroy(ak_slab_root* root)
+static void ak_slab_merge_remote(ak_slab_root* root)
 {
-    ak_slab_release_pages(root, &(root->empty_root), AK_U32_MAX);
-    ak_slab_release_pages(root, &(root->partial_root), AK_U32_MAX);
-    ak_slab_release_pages(root, &(root->full_root), AK_U32_MAX);
-    root->nempty = 0;
-    root->release = 0;
+    ak_slab* slab = (ak_slab*)ak_atomic_xchg_ptr(ak_as_ptr(root->REMOTE), AK_NULLPTR);
+    while (slab) {
+        // read the link before taking the objects, the page may be queued again right after
+        ak_slab* next = slab->rnext;
+        void* p = ak_atomic_xchg_ptr(ak_as_ptr(slab->rfree), AK_NULLPTR);
+        AKMALLOC_ASSERT(p);
+        while (p) {
+            void* pnext = *(void**)p;
+            ak_slab_free_locked(root, p);
+            p = pnext;
+        }
+        slab = next;
+    }
 }
-/********************** slab end ************************/
 
-/********************** coalescing allocator begin **********************/
-/*!
+#define ak_slab_merge_remote_if_any(root)                          \
+  do {                                                             \
+    ak_slab_root* const rMR = (root);                              \
+    if (ak_unlikely(*(ak_slab* volatile*)ak_as_ptr(rMR->REMOTE))) { \
+        ak_slab_merge_remote(rMR);                                 \
+    }                                                              \
+  } while (0)
+
+/*!
+ * Attempt to allocate memory from the slab allocator root with the lock held.
+ * \param root; Pointer to the allocator root
+ *
+ * \return \c 0 on failure, else pointer to at least \p root->sz bytes of memory.
+ */
+ak_inline static void* ak_slab_alloc_locked(ak_slab_root* root)
+{
+    ak_slab_merge_remote_if_any(root);
+
+    ak_slab* slab = ak_slab_alloc_page(root);
+    if (ak_unlikely(!slab)) {
+        return AK_NULLPTR;
+    }
+
+    void* mem = ak_slab_search(slab, root->sz);
+    ak_slab_relink(root, slab);
+    return mem;
+}
+
+#if !defined(AK_SLAB_LOCKFREE)
+/*!
+ * Return empty pages to the OS. Remotely freed objects are merged first, so that pages they
+ * empty are counted. The pages are detached under the lock and returned to the OS, or to the
+ * page depot, after it is released.
+ * \param root; Pointer to the allocator root
+ * \param maxpages; The most pages to return
+ * \param minrelease; Return nothing unless this many pages were emptied since the last release
+ */
+static void ak_slab_release_empty(ak_slab_root* root, ak_u32 maxpages, ak_u32 minrelease)
+{
+    ak_slab* detached = AK_NULLPTR;
+    AK_SLAB_LOCK_ACQUIRE(root);
+    ak_slab_merge_remote_if_any(root);
+    if (root->release < minrelease) {
+        AK_SLAB_LOCK_RELEASE(root);
+        return;
+    }
+    ak_u32 numtofree = root->nempty;
+    numtofree = (numtofree > maxpages) ? maxpages : numtofree;
+    for (ak_u32 ct = 0; ct < numtofree; ++ct) {
+        ak_slab* s = root->empty_root.fd;
+        ak_slab_unlink(s);
+        s->fd = detached;
+        detached = s;
+    }
+    root->nempty -= numtofree;
+    root->release = 0;
+    AK_SLAB_LOCK_RELEASE(root);
+
+    while (detached) {
+        ak_slab* next = detached->fd;
+        if ((root->spansz != AKMALLOC_DEFAULT_PAGE_SIZE) || !ak_slab_depot_put(detached)) {
+            ak_slab_free_page(detached, root->spansz);
+        }
+        detached = next;
+    }
+}
+#endif
+
+/*!
+ * Return empty pages to the OS if the release rate was reached.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_slab_release_os_mem(ak_slab_root* root)
+{
+#if defined(AK_SLAB_LOCKFREE)
+    // pages are never returned while the root is alive
+    (void)root;
+#else
+    // pending remote frees may empty enough pages to reach the release rate
+    if ((*(volatile ak_u32*)ak_as_ptr(root->release) >= root->RELEASE_RATE) ||
+        *(ak_slab* volatile*)ak_as_ptr(root->REMOTE)) {
+        ak_slab_release_empty(root, root->MAX_PAGES_TO_FREE, root->RELEASE_RATE);
+    }
+#endif
+}
+
+#if defined(AK_SLAB_LOCKFREE)
+#  define ak_slab_release_if_due(root)
+#else
+#  define ak_slab_release_if_due(root)                                                  \
+  do {                                                                                  \
+    ak_slab_root* const rRD = (root);                                                   \
+    if (ak_unlikely(*(volatile ak_u32*)ak_as_ptr(rRD->release) >= rRD->RELEASE_RATE) && \
+        !rRD->DEFER_RELEASE) {                                                          \
+        ak_slab_release_os_mem(rRD);                                                    \
+    }                                                                                   \
+  } while (0)
+#endif
+
+/*!
+ * Map pages without the lock and allocate from them.
+ * \param root; Pointer to the allocator root
+ *
+ * \return \c 0 on failure, else pointer to at least \p root->sz bytes of memory.
+ */
+static void* ak_slab_alloc_refill(ak_slab_root* root)
+{
+    ak_u32 npages;
+    char* pages = ak_slab_get_pages(root, &npages);
+    if (ak_unlikely(!pages)) {
+        return AK_NULLPTR;
+    }
+    AK_SLAB_LOCK_ACQUIRE(root);
+    ak_slab_add_pages(root, pages, npages);
+    void* mem = ak_slab_alloc_locked(root);
+    AK_SLAB_LOCK_RELEASE(root);
+    return mem;
+}
+
+/*!
+ * Allocate up to \p n objects with the lock held, taking all the free objects of a bitmap word
+ * at a time.
+ * \param root; Pointer to the allocator root
+ * \param out; Array that receives the allocated pointers
+ * \param n; Number of objects requested
+ *
+ * \return The number of objects written to \p out, which is less than \p n on failure.
+ */
+static ak_u32 ak_slab_alloc_n_locked(ak_slab_root* root, void** out, ak_u32 n)
+{
+    ak_slab_merge_remote_if_any(root);
+
+    const ak_sz sz = root->sz;
+    ak_u32 i = 0;
+    while (i < n) {
+        ak_slab* slab = ak_slab_alloc_page(root);
+        if (ak_unlikely(!slab)) {
+            break;
+        }
+
+        const ak_u32 i0 = i;
+        char* const base = ak_slab_2_mem(slab);
+        for (int w = 0; (w < AK_BITSET512_WORDS) && (i < n); ++w) {
+            ak_bitset64* pw = ak_slab_avail_word(slab, w << 6);
+            ak_bitset64 v = *pw;
+            while (v && (i < n)) {
+                int b;
+                ak_bitset64_fill_num_trailing_zeros(&v, b);
+                v &= (v - 1);
+                out[i++] = base + ((ak_sz)((w << 6) + b) * sz);
+            }
+            *pw = v;
+        }
+        slab->nfree -= (i - i0);
+        ak_slab_relink(root, slab);
+    }
+    return i;
+}
+
+/*!
+ * Attempt to allocate memory from the slab allocator root.
+ * \param root; Pointer to the allocator root
+ *
+ * \return \c 0 on failure, else pointer to at least \p root->sz bytes of memory.
+ */
+ak_inline static void* ak_slab_alloc(ak_slab_root* root)
+{
+#if defined(AK_SLAB_LOCKFREE)
+    return ak_slab_alloc_lockfree(root);
+#else
+    AK_SLAB_LOCK_ACQUIRE(root);
+    void* mem = ak_slab_alloc_locked(root);
+    AK_SLAB_LOCK_RELEASE(root);
+    if (ak_unlikely(!mem)) {
+        mem = ak_slab_alloc_refill(root);
+    }
+    return mem;
+#endif
+}
+
+/*!
+ * Return memory to the slab allocator root. If another thread holds the root lock, the memory is
+ * queued for it to merge instead of waiting.
+ * \param p; Pointer to the memory to return.
+ */
+ak_inline static void ak_slab_free(void* p)
+{
+#if defined(AK_SLAB_LOCKFREE)
+    ak_slab_free_lockfree(p);
+#else
+    ak_slab_root* root = ak_slab_of(p)->root;
+    AKMALLOC_ASSERT(root);
+
+    if (ak_unlikely(!AK_SLAB_LOCK_TRY(root))) {
+        ak_slab_free_remote(root, p);
+        return;
+    }
+    ak_slab_merge_remote_if_any(root);
+    ak_slab_free_locked(root, p);
+    AK_SLAB_LOCK_RELEASE(root);
+    ak_slab_release_if_due(root);
+#endif
+}
+
+/*!
+ * Attempt to allocate several objects from the slab allocator root, taking the lock once.
+ * \param root; Pointer to the allocator root
+ * \param out; Array that receives the allocated pointers
+ * \param n; Number of objects requested
+ *
+ * \return The number of objects written to \p out, which is less than \p n on failure.
+ */
+static ak_u32 ak_slab_alloc_n(ak_slab_root* root, void** out, ak_u32 n)
+{
+    ak_u32 i = 0;
+#if defined(AK_SLAB_LOCKFREE)
+    for (; i < n; ++i) {
+        void* mem = ak_slab_alloc_lockfree(root);
+        if (ak_unlikely(!mem)) {
+            break;
+        }
+        out[i] = mem;
+    }
+#else
+    AK_SLAB_LOCK_ACQUIRE(root);
+    i = ak_slab_alloc_n_locked(root, out, n);
+    AK_SLAB_LOCK_RELEASE(root);
+    while (ak_unlikely(i < n)) {
+        ak_u32 npages;
+        char* pages = ak_slab_get_pages(root, &npages);
+        if (ak_unlikely(!pages)) {
+            break;
+        }
+        AK_SLAB_LOCK_ACQUIRE(root);
+        ak_slab_add_pages(root, pages, npages);
+        i += ak_slab_alloc_n_locked(root, out + i, n - i);
+        AK_SLAB_LOCK_RELEASE(root);
+    }
+#endif
+    return i;
+}
+
+/*!
+ * Return several objects to their slab allocator roots. Consecutive objects from the same root
+ * are returned under one acquisition of its lock, or queued remotely if it is held.
+ * \param p; Array of pointers to the memory to return
+ * \param n; Number of pointers in \p p
+ */
+static void ak_slab_free_n(void** p, ak_u32 n)
+{
+#if defined(AK_SLAB_LOCKFREE)
+    for (ak_u32 i = 0; i < n; ++i) {
+        ak_slab_free_lockfree(p[i]);
+    }
+#else
+    ak_u32 i = 0;
+    while (i < n) {
+        ak_slab_root* root = ak_slab_of(p[i])->root;
+        AKMALLOC_ASSERT(root);
+        if (ak_unlikely(!AK_SLAB_LOCK_TRY(root))) {
+            do {
+                ak_slab_free_remote(root, p[i]);
+                ++i;
+            } while ((i < n) && (ak_slab_of(p[i])->root == root));
+            continue;
+        }
+        ak_slab_merge_remote_if_any(root);
+        do {
+            // the run of pointers into this page
+            ak_slab* slab = ak_slab_of(p[i]);
+            do {
+                ak_slab_mark_free(root, slab, p[i]);
+                ++i;
+            } while ((i < n) && (ak_slab_of(p[i]) == slab));
+            ak_slab_relink(root, slab);
+        } while ((i < n) && (ak_slab_of(p[i])->root == root));
+        AK_SLAB_LOCK_RELEASE(root);
+        ak_slab_release_if_due(root);
+    }
+#endif
+}
+
+/*!
+ * Destroy the slab allocator root and return all memory to the OS.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_slab_destroy(ak_slab_root* root)
+{
+    ak_slab_release_pages(root, &(root->empty_root), AK_U32_MAX);
+    for (int i = 0; i < AK_SLAB_PARTIAL_BUCKETS; ++i) {
+        ak_slab_release_pages(root, &(root->partial_root[i]), AK_U32_MAX);
+    }
+    ak_slab_release_pages(root, &(root->full_root), AK_U32_MAX);
+    ak_slab_release_fresh(root);
+    root->nempty = 0;
+    root->release = 0;
+    root->partial = 0;
+    root->REMOTE = AK_NULLPTR;
+}
+/********************** slab end ************************/
+
+/********************** coalescing allocator begin **********************/
+/*!
  *
  * \page caalloc Coalescing allocator with a free list
  *
@@ -1747,6 +3036,12 @@ static void ak_slab_destroy(ak_slab_root* root)
  * another user-settable number of them. The default is for both number to be equal, which means
  * every so often, a slab allocator will return all its free pages to the OS.
  *
+ * Like the fastbins in <tt>dlmalloc</tt>, freed chunks are first pushed on a quick list for their
+ * exact size without being coalesced. They still look allocated to their neighbours. An allocation
+ * of the same size pops one without searching the free list. The quick lists are consolidated,
+ * i.e. their chunks are coalesced and threaded into the free list, when an allocation finds no
+ * fitting chunk in the free list or when they hold too many chunks.
+ *
  * This allocator can be made thread safe upon request.
  */
 
@@ -1769,16 +3064,26 @@ static void ak_slab_destroy(ak_slab_root* root)
 #  define AK_COALESCE_SEGMENT_SIZE AK_COALESCE_SEGMENT_GRANULARITY
 #endif
 
+#if !defined(AK_CA_QUICK_BINS)
+#  define AK_CA_QUICK_BINS 16
+#endif
+
+#if !defined(AK_CA_QUICK_MAX)
+#  define AK_CA_QUICK_MAX 64
+#endif
+
 #if defined(AK_CA_USE_LOCKS)
-#  define AK_CA_LOCK_DEFINE(nm)    ak_spinlock nm
-#  define AK_CA_LOCK_INIT(root)    ak_spinlock_init(ak_as_ptr((root)->LOCKED))
-#  define AK_CA_LOCK_ACQUIRE(root) ak_spinlock_acquire(ak_as_ptr((root)->LOCKED))
-#  define AK_CA_LOCK_RELEASE(root) ak_spinlock_release(ak_as_ptr((root)->LOCKED))
+#  define AK_CA_LOCK_DEFINE(nm)    ak_lock nm
+#  define AK_CA_LOCK_INIT(root)    ak_lock_init(ak_as_ptr((root)->LOCKED))
+#  define AK_CA_LOCK_ACQUIRE(root) ak_lock_acquire_if_needed(ak_as_ptr((root)->LOCKED))
+#  define AK_CA_LOCK_RELEASE(root) ak_lock_release_if_needed(ak_as_ptr((root)->LOCKED))
+#  define AK_CA_LOCK_TRY(root)     ak_lock_try_acquire_if_needed(ak_as_ptr((root)->LOCKED))
 #else
 #  define AK_CA_LOCK_DEFINE(nm)
 #  define AK_CA_LOCK_INIT(root)
 #  define AK_CA_LOCK_ACQUIRE(root)
 #  define AK_CA_LOCK_RELEASE(root)
+#  define AK_CA_LOCK_TRY(root)     1
 #endif
 
 typedef ak_sz ak_alloc_info;
@@ -1817,23 +3122,36 @@ struct ak_ca_segment_tag
 
 /*!
  * The root for a coalescing allocator.
+ *
+ * Laid out like \c ak_slab_root: read mostly configuration, then the queue of chunks freed by
+ * contending threads on its own cache line, then the lock and the lists it protects.
  */
 struct ak_ca_root_tag
 {
-    ak_ca_segment main_root;        /**< root of non empty segments */
-    ak_ca_segment empty_root;       /**< root of empty segments */
+    ak_sz MIN_SIZE_TO_SPLIT;        /**< minimum size of split node to decide whether to 
+                                         split a free list node */
+    ak_u32 RELEASE_RATE;            /**< release rate for this root */
+    ak_u32 MAX_SEGMENTS_TO_FREE;    /**< number of segments to free when release is done */
+    ak_u32 DEFER_RELEASE;           /**< leave releasing segments to the maintenance thread */
 
-    ak_free_list_node free_root;    /**< root of the free list */
+    AK_CACHE_ALIGNED
+    void* PENDING;                  /**< chunks freed while the root was locked, see ak_ca_free */
 
+    AK_CACHE_ALIGNED
     ak_u32 nempty;                  /**< number of empty segments */
     ak_u32 release;                 /**< number of segments freed since last release */
+    AK_CA_LOCK_DEFINE(LOCKED);      /**< lock for this allocator if locks are enabled */
+    ak_u32 nquick;                  /**< number of chunks held in the quick lists */
 
-    ak_u32 RELEASE_RATE;            /**< release rate for this root */
-    ak_u32 MAX_SEGMENTS_TO_FREE;    /**< number of segments to free when release is done */
-    ak_sz MIN_SIZE_TO_SPLIT;        /**< minimum size of split node to decide whether to 
-                                         split a free list node */
+    ak_free_list_node free_root;    /**< root of the free list */
 
-    AK_CA_LOCK_DEFINE(LOCKED);      /**< lock for this allocator if locks are enabled */
+#if AK_CA_QUICK_BINS > 0
+    ak_sz quick_sz[AK_CA_QUICK_BINS];   /**< chunk size held by each quick list, 0 if empty */
+    void* quick[AK_CA_QUICK_BINS];      /**< quick lists of freed chunks that were not coalesced */
+#endif
+
+    ak_ca_segment main_root;        /**< root of non empty segments */
+    ak_ca_segment empty_root;       /**< root of empty segments */
 };
 
 /**************************************************************/
@@ -2038,26 +3356,41 @@ static int ak_ca_add_new_segment(ak_ca_root* root, char* mem, ak_sz sz)
     return 0;
 }
 
-static int ak_ca_get_new_segment(ak_ca_root* root, ak_sz sz)
+/* segment size that can hold an allocation of sz, aligned to a segment size multiple */
+#define ak_ca_segment_size_for(sz) \
+    ak_ca_aligned_segment_size((sz) + sizeof(ak_ca_segment) + sizeof(ak_alloc_node) + sizeof(ak_free_list_node))
+
+static int ak_ca_reuse_segment(ak_ca_root* root, ak_sz sz)
 {
-    // align to segment size multiple
-    sz += sizeof(ak_ca_segment) + sizeof(ak_alloc_node) + sizeof(ak_free_list_node);
-    sz = ak_ca_aligned_segment_size(sz);
+    sz = ak_ca_segment_size_for(sz);
 
     // search empty_root for a segment that is as big or more
-    char* mem = AK_NULLPTR;
-    ak_sz segsz = sz;
     ak_circ_list_for_each(ak_ca_segment, seg, ak_as_ptr(root->empty_root)) {
         if (seg->sz >= sz) {
-            mem = (char*)(seg->head);
-            segsz = seg->sz;
+            char* mem = (char*)(seg->head);
+            ak_sz segsz = seg->sz;
             ak_ca_segment_unlink(seg);
             --(root->nempty);
-            break;
+            return ak_ca_add_new_segment(root, mem, segsz);
         }
     }
+    return 0;
+}
 
-    return ak_ca_add_new_segment(root, mem ? mem : ((char*)ak_os_alloc(sz)), segsz);
+/* maps a new segment of segsz bytes, called without the lock */
+static char* ak_ca_map_segment(ak_ca_root* root, ak_sz segsz)
+{
+    char* mem = (char*)ak_os_alloc(segsz);
+#if defined(AK_USE_PAGEMAP)
+    // record the owner of the segment
+    if (ak_likely(mem) && ak_unlikely(!ak_pagemap_set_range(mem, segsz, (ak_sz)root))) {
+        ak_os_free(mem, segsz);
+        mem = AK_NULLPTR;
+    }
+#else
+    (void)root;
+#endif
+    return mem;
 }
 
 static ak_u32 ak_ca_return_os_mem(ak_ca_segment* r, ak_u32 num)
@@ -2077,51 +3410,272 @@ static ak_u32 ak_ca_return_os_mem(ak_ca_segment* r, ak_u32 num)
     return ct;
 }
 
-/**************************************************************/
-/* P U B L I C                                                */
-/**************************************************************/
-
 /*!
- * Initialize a coalescing allocator.
- * \param root; Pointer to the allocator root to initialize (non-NULL)
- * \param relrate; Release rate, \ref akmallocDox
- * \param maxsegstofree; Number of segments to free upon release, \ref akmallocDox
+ * Coalesce a chunk with its free neighbours and thread it into the free list.
+ * \param root; Pointer to the allocator root
+ * \param m; The memory to return.
  */
-static void ak_ca_init_root(ak_ca_root* root, ak_u32 relrate, ak_u32 maxsegstofree)
+static void ak_ca_coalesce_locked(ak_ca_root* root, void* m)
 {
-    AKMALLOC_ASSERT_ALWAYS(AK_COALESCE_SEGMENT_SIZE % AK_COALESCE_SEGMENT_GRANULARITY == 0);
-    AKMALLOC_ASSERT_ALWAYS(((AK_COALESCE_SEGMENT_SIZE & (AK_COALESCE_SEGMENT_SIZE - 1)) == 0) && "Segment size must be a power of 2");
+    // get alloc header before
+    ak_alloc_node* node = ((ak_alloc_node*)m) - 1;
 
-    ak_ca_segment_link(&(root->main_root), &(root->main_root), &(root->main_root));
-    ak_ca_segment_link(&(root->empty_root), &(root->empty_root), &(root->empty_root));
-    ak_free_list_node_link(&(root->free_root), &(root->free_root), &(root->free_root));
-    root->nempty = root->release = 0;
+    ak_alloc_node* nextnode = ak_ca_next_node(node);
+    ak_alloc_node* prevnode = ak_ca_prev_node(node);
+    int coalesce = 0;
 
-    root->RELEASE_RATE = relrate;
-    root->MAX_SEGMENTS_TO_FREE = maxsegstofree;
-    root->MIN_SIZE_TO_SPLIT = (sizeof(ak_free_list_node) >= AK_COALESCE_ALIGN) ? sizeof(ak_free_list_node) : AK_COALESCE_ALIGN;
-    AK_CA_LOCK_INIT(root);
-}
+    // mark as free
+    AKMALLOC_ASSERT(!ak_ca_is_free(node->currinfo));
+    AKMALLOC_ASSERT(!nextnode || (node->currinfo == nextnode->previnfo));
+    ak_ca_set_is_free(ak_as_ptr(node->currinfo), 1);
+    ak_ca_update_footer(node);
+    
+    // coalesce if free before or if free after or both
+    if (prevnode && ak_ca_is_free(node->previnfo)) {
+        // coalesce back
+        // update node and the footer
+        ak_sz newsz = ak_ca_to_sz(node->previnfo) + ak_ca_to_sz(node->currinfo) + sizeof(ak_alloc_node);
+        ak_ca_set_sz(ak_as_ptr(prevnode->currinfo), newsz);
+        ak_ca_set_is_last(ak_as_ptr(prevnode->currinfo), nextnode == AK_NULLPTR);
+        ak_ca_update_footer(prevnode);
+        AKMALLOC_ASSERT(!nextnode || ak_ca_next_node(prevnode) == nextnode);
+        AKMALLOC_ASSERT(!nextnode || prevnode->currinfo == nextnode->previnfo);
+        coalesce += 1;
+        // update free list
+    }
 
-/*!
- * Default initialize a coalescing allocator.
- * \param root; Pointer to the allocator root to initialize (non-NULL)
- */
-ak_inline static void ak_ca_init_root_default(ak_ca_root* root)
-{
-#if AKMALLOC_BITNESS == 32
-    static const ak_u32 rate =  255;
-#else
-    static const ak_u32 rate = 2047;
-#endif
-    ak_ca_init_root(root, rate, rate);
-}
+    if (nextnode && ak_ca_is_free(nextnode->currinfo)) {
+        // coalesce forward
+        // update node and the footer
+        ak_alloc_node* n = (coalesce) ? prevnode : node;
+        ak_sz newsz = ak_ca_to_sz(n->currinfo) + ak_ca_to_sz(nextnode->currinfo) + sizeof(ak_alloc_node);
+        ak_ca_set_sz(ak_as_ptr(n->currinfo), newsz);
+        ak_ca_set_is_last(ak_as_ptr(n->currinfo), ak_ca_is_last(nextnode->currinfo));
+        ak_ca_update_footer(n);
+        AKMALLOC_ASSERT(ak_ca_is_last(n->currinfo) || (n->currinfo == ak_ca_next_node(nextnode)->previnfo));
+        coalesce += 2;
+    }
 
-/*!
- * Attempt to grow an existing allocation.
- * \param root; Pointer to the allocator root
- * \param mem; Existing memory to grow
- * \param newsz; The new size for the allocation
+    // update free lists
+    ak_alloc_node* tocheck = AK_NULLPTR;
+    switch (coalesce) {
+        case 0: {
+                // thread directly
+                ak_free_list_node* fl = (ak_free_list_node*)(node + 1);
+                ak_free_list_node_link(fl, root->free_root.fd, ak_as_ptr(root->free_root));
+            }
+            break;
+        case 1: {
+                // prevnode already threaded through
+                tocheck = prevnode;
+            }
+            break;
+        case 2: {
+                // copy free list entry from nextnode
+                ak_free_list_node* fl = (ak_free_list_node*)(node + 1);
+                ak_free_list_node* nextfl = (ak_free_list_node*)(nextnode + 1);
+                ak_free_list_node_link(fl, nextfl->fd, nextfl->bk);
+                tocheck = node;
+            }
+            break;
+        case 3: {
+                ak_free_list_node* nextfl = (ak_free_list_node*)(nextnode + 1);
+                ak_free_list_node_unlink(nextfl);
+                tocheck = prevnode;
+            }
+            break;
+        default:
+            AKMALLOC_ASSERT_ALWAYS(0 && "Should not get here!");
+            break;
+    }
+
+    // move to empty if segment is empty
+
+    if (tocheck && ak_ca_is_first(tocheck->currinfo) && ak_ca_is_last(tocheck->currinfo)) {
+        // remove free list entry
+        ak_free_list_node* fl = (ak_free_list_node*)(tocheck + 1);
+        ak_free_list_node_unlink(fl);
+        // actual size is in tocheck->previnfo
+        AKMALLOC_ASSERT(tocheck->previnfo == ak_ca_to_sz(tocheck->currinfo));
+        ak_ca_segment* seg = ak_ptr_cast(ak_ca_segment, ((char*)(tocheck + 1) + tocheck->previnfo));
+        AKMALLOC_ASSERT(tocheck->previnfo == (seg->sz - sizeof(ak_alloc_node) - sizeof(ak_ca_segment)));
+        ak_ca_segment_unlink(seg);
+        ak_ca_segment_link(seg, root->empty_root.fd, ak_as_ptr(root->empty_root));
+        // segments are returned to the OS after the lock is released, see ak_ca_release_if_due
+        ++(root->nempty); ++(root->release);
+    }
+}
+
+#if AK_CA_QUICK_BINS > 0
+
+#define ak_ca_quick_bin(sz) ((((ak_sz)(sz)) / AK_COALESCE_ALIGN) % AK_CA_QUICK_BINS)
+
+/*!
+ * Coalesce every chunk held in the quick lists.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_ca_consolidate_locked(ak_ca_root* root)
+{
+    for (ak_sz i = 0; i != AK_CA_QUICK_BINS; ++i) {
+        void* p = root->quick[i];
+        while (p) {
+            void* next = *(void**)p;
+            ak_ca_coalesce_locked(root, p);
+            p = next;
+        }
+        root->quick[i] = AK_NULLPTR;
+        root->quick_sz[i] = 0;
+    }
+    root->nquick = 0;
+}
+
+/*!
+ * Pop a chunk of exactly \p sz bytes from the quick lists.
+ * \param root; Pointer to the allocator root
+ * \param sz; The aligned size
+ *
+ * \return \c 0 if there is none, else the memory.
+ */
+ak_inline static void* ak_ca_quick_pop(ak_ca_root* root, ak_sz sz)
+{
+    const ak_sz idx = ak_ca_quick_bin(sz);
+    void* p = root->quick[idx];
+    if (p && (root->quick_sz[idx] == sz)) {
+        void* next = *(void**)p;
+        root->quick[idx] = next;
+        if (!next) {
+            root->quick_sz[idx] = 0;
+        }
+        --(root->nquick);
+        return p;
+    }
+    return AK_NULLPTR;
+}
+
+/*!
+ * Push freed memory on the quick list for its size.
+ * \param root; Pointer to the allocator root
+ * \param m; The memory to return.
+ *
+ * \return \c 0 if the quick list for the size holds another size, \c 1 on success.
+ */
+ak_inline static int ak_ca_quick_push(ak_ca_root* root, void* m)
+{
+    const ak_sz sz = ak_ca_to_sz((((ak_alloc_node*)m) - 1)->currinfo);
+    const ak_sz idx = ak_ca_quick_bin(sz);
+    if (root->quick[idx] && (root->quick_sz[idx] != sz)) {
+        return 0;
+    }
+    if (ak_unlikely(root->nquick >= AK_CA_QUICK_MAX)) {
+        ak_ca_consolidate_locked(root);
+    }
+    *(void**)m = root->quick[idx];
+    root->quick[idx] = m;
+    root->quick_sz[idx] = sz;
+    ++(root->nquick);
+    return 1;
+}
+
+#else
+
+#  define ak_ca_consolidate_locked(root)
+#  define ak_ca_quick_pop(root, sz) AK_NULLPTR
+#  define ak_ca_quick_push(root, m) 0
+
+#endif
+
+/*!
+ * Queue a chunk freed while the root lock is held by another thread.
+ * \param root; Pointer to the allocator root that owns \p m
+ * \param m; The memory to return.
+ */
+static void ak_ca_free_pending(ak_ca_root* root, void* m)
+{
+    void* head;
+    do {
+        head = *(void* volatile*)ak_as_ptr(root->PENDING);
+        *(void**)m = head;
+    } while (!ak_atomic_cas_ptr(ak_as_ptr(root->PENDING), m, head));
+}
+
+/*!
+ * Return all queued chunks. Must be called with the lock held.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_ca_drain_pending(ak_ca_root* root)
+{
+    void* p = ak_atomic_xchg_ptr(ak_as_ptr(root->PENDING), AK_NULLPTR);
+    while (p) {
+        void* next = *(void**)p;
+        if (!ak_ca_quick_push(root, p)) {
+            ak_ca_coalesce_locked(root, p);
+        }
+        p = next;
+    }
+}
+
+#define ak_ca_drain_pending_if_any(root)                             \
+  do {                                                               \
+    ak_ca_root* const rDP = (root);                                  \
+    if (ak_unlikely(*(void* volatile*)ak_as_ptr(rDP->PENDING))) {    \
+        ak_ca_drain_pending(rDP);                                    \
+    }                                                                \
+  } while (0)
+
+/**************************************************************/
+/* P U B L I C                                                */
+/**************************************************************/
+
+/*!
+ * Initialize a coalescing allocator.
+ * \param root; Pointer to the allocator root to initialize (non-NULL)
+ * \param relrate; Release rate, \ref akmallocDox
+ * \param maxsegstofree; Number of segments to free upon release, \ref akmallocDox
+ */
+static void ak_ca_init_root(ak_ca_root* root, ak_u32 relrate, ak_u32 maxsegstofree)
+{
+    AKMALLOC_ASSERT_ALWAYS(AK_COALESCE_SEGMENT_SIZE % AK_COALESCE_SEGMENT_GRANULARITY == 0);
+    AKMALLOC_ASSERT_ALWAYS(((AK_COALESCE_SEGMENT_SIZE & (AK_COALESCE_SEGMENT_SIZE - 1)) == 0) && "Segment size must be a power of 2");
+
+    ak_ca_segment_link(&(root->main_root), &(root->main_root), &(root->main_root));
+    ak_ca_segment_link(&(root->empty_root), &(root->empty_root), &(root->empty_root));
+    ak_free_list_node_link(&(root->free_root), &(root->free_root), &(root->free_root));
+    root->nempty = root->release = 0;
+
+    root->RELEASE_RATE = relrate;
+    root->MAX_SEGMENTS_TO_FREE = maxsegstofree;
+    root->DEFER_RELEASE = 0;
+    root->PENDING = AK_NULLPTR;
+    root->nquick = 0;
+#if AK_CA_QUICK_BINS > 0
+    for (ak_sz i = 0; i != AK_CA_QUICK_BINS; ++i) {
+        root->quick_sz[i] = 0;
+        root->quick[i] = AK_NULLPTR;
+    }
+#endif
+    root->MIN_SIZE_TO_SPLIT = (sizeof(ak_free_list_node) >= AK_COALESCE_ALIGN) ? sizeof(ak_free_list_node) : AK_COALESCE_ALIGN;
+    AK_CA_LOCK_INIT(root);
+}
+
+/*!
+ * Default initialize a coalescing allocator.
+ * \param root; Pointer to the allocator root to initialize (non-NULL)
+ */
+ak_inline static void ak_ca_init_root_default(ak_ca_root* root)
+{
+#if AKMALLOC_BITNESS == 32
+    static const ak_u32 rate =  255;
+#else
+    static const ak_u32 rate = 2047;
+#endif
+    ak_ca_init_root(root, rate, rate);
+}
+
+/*!
+ * Attempt to grow an existing allocation.
+ * \param root; Pointer to the allocator root
+ * \param mem; Existing memory to grow
+ * \param newsz; The new size for the allocation
  *
  * \return \c 0 on failure, and \p mem on success which can hold at least \p newsz bytes.
  */
@@ -2129,24 +3683,26 @@ ak_inline static void* ak_ca_realloc_in_place(ak_ca_root* root, void* mem, ak_sz
 {
     void* retmem = AK_NULLPTR;
 
+    newsz = ak_ca_aligned_size(newsz);
     ak_alloc_node* n = ak_ptr_cast(ak_alloc_node, mem) - 1;
-    AKMALLOC_ASSERT(ak_ca_is_free(n->currinfo));
+    AKMALLOC_ASSERT(!ak_ca_is_free(n->currinfo));
     // check if there is a free next, if so, maybe merge
     ak_sz sz = ak_ca_to_sz(n->currinfo);
 
+    // the next node can be allocated or merged by other threads, so only look at it locked
+    AK_CA_LOCK_ACQUIRE(root);
     ak_alloc_node* next = ak_ca_next_node(n);
     if (next && ak_ca_is_free(next->currinfo)) {
         AKMALLOC_ASSERT(n->currinfo == next->previnfo);
         ak_sz nextsz = ak_ca_to_sz(next->currinfo);
         ak_sz totalsz = nextsz + sz + sizeof(ak_alloc_node);
         if (totalsz >= newsz) {
-            AK_CA_LOCK_ACQUIRE(root);
-
             // we could remember the prev and next free entries and link them
             // back if the freed size is larger and we split the new node
             // but we assume that reallocs are rare and that one realloc may get more
             // so we try to keep it simple here, and simply merge the two
 
+            ak_free_list_node nextcopy = *(ak_free_list_node*)(next + 1);
             ak_free_list_node_unlink((ak_free_list_node*)(next + 1));
             // don't need to change attributes on next as it is going away
             if (ak_ca_is_last(next->currinfo)) {
@@ -2178,10 +3734,9 @@ ak_inline static void* ak_ca_realloc_in_place(ak_ca_root* root, void* mem, ak_sz
             }
 
             retmem = mem;
-
-            AK_CA_LOCK_RELEASE(root);
         }
     }
+    AK_CA_LOCK_RELEASE(root);
 
     return retmem;
 }
@@ -2198,126 +3753,114 @@ static void* ak_ca_alloc(ak_ca_root* root, ak_sz s)
     // align and round size
     ak_sz sz = ak_ca_aligned_size(s);
     AK_CA_LOCK_ACQUIRE(root);
+    ak_ca_drain_pending_if_any(root);
+    void* mem = ak_ca_quick_pop(root, sz);
+    if (mem) {
+        AK_CA_LOCK_RELEASE(root);
+        return mem;
+    }
     // search free list
     ak_sz splitsz = root->MIN_SIZE_TO_SPLIT;
-    void* mem = ak_ca_search_free_list(ak_as_ptr(root->free_root), sz, splitsz);
-    // add new segment
+    mem = ak_ca_search_free_list(ak_as_ptr(root->free_root), sz, splitsz);
+    if (!mem && root->nquick) {
+        // coalescing the quick lists may produce a chunk that fits
+        ak_ca_consolidate_locked(root);
+        mem = ak_ca_search_free_list(ak_as_ptr(root->free_root), sz, splitsz);
+    }
+    // reuse an empty segment
+    if (ak_unlikely(!mem) && ak_ca_reuse_segment(root, sz)) {
+        mem = ak_ca_search_free_list(ak_as_ptr(root->free_root), sz, splitsz);
+        AKMALLOC_ASSERT(mem);
+    }
+    AK_CA_LOCK_RELEASE(root);
+
+    // map a new segment without the lock, other threads may add segments meanwhile and the
+    // new one simply joins them
     if (ak_unlikely(!mem)) {
-        // NOTE: could also move segments from empty_root to main_root
-        if (ak_likely(ak_ca_get_new_segment(root, sz))) {
+        const ak_sz segsz = ak_ca_segment_size_for(sz);
+        char* seg = ak_ca_map_segment(root, segsz);
+        if (ak_likely(seg)) {
+            AK_CA_LOCK_ACQUIRE(root);
+            ak_ca_add_new_segment(root, seg, segsz);
             mem = ak_ca_search_free_list(ak_as_ptr(root->free_root), sz, splitsz);
             AKMALLOC_ASSERT(mem);
+            AK_CA_LOCK_RELEASE(root);
         }
     }
-    AK_CA_LOCK_RELEASE(root);
     return mem;
 }
 
 /*!
- * Return memory to the coalescing allocator root.
+ * Return memory to the coalescing allocator root with the lock held.
  * \param root; Pointer to the allocator root
  * \param m; The memory to return.
  */
-ak_inline static void ak_ca_free(ak_ca_root* root, void* m)
+ak_inline static void ak_ca_free_locked(ak_ca_root* root, void* m)
 {
-    // get alloc header before
-    ak_alloc_node* node = ((ak_alloc_node*)m) - 1;
-
-    AK_CA_LOCK_ACQUIRE(root);
-
-    ak_alloc_node* nextnode = ak_ca_next_node(node);
-    ak_alloc_node* prevnode = ak_ca_prev_node(node);
-    int coalesce = 0;
+    if (!ak_ca_quick_push(root, m)) {
+        ak_ca_coalesce_locked(root, m);
+    }
+}
 
-    // mark as free
-    AKMALLOC_ASSERT(!ak_ca_is_free(node->currinfo));
-    AKMALLOC_ASSERT(!nextnode || (node->currinfo == nextnode->previnfo));
-    ak_ca_set_is_free(ak_as_ptr(node->currinfo), 1);
-    ak_ca_update_footer(node);
-    
-    // NOTE: maybe this should happen at a lower frequency?
-    // coalesce if free before or if free after or both
-    if (prevnode && ak_ca_is_free(node->previnfo)) {
-        // coalesce back
-        // update node and the footer
-        ak_sz newsz = ak_ca_to_sz(node->previnfo) + ak_ca_to_sz(node->currinfo) + sizeof(ak_alloc_node);
-        ak_ca_set_sz(ak_as_ptr(prevnode->currinfo), newsz);
-        ak_ca_set_is_last(ak_as_ptr(prevnode->currinfo), nextnode == AK_NULLPTR);
-        ak_ca_update_footer(prevnode);
-        AKMALLOC_ASSERT(!nextnode || ak_ca_next_node(prevnode) == nextnode);
-        AKMALLOC_ASSERT(!nextnode || prevnode->currinfo == nextnode->previnfo);
-        coalesce += 1;
-        // update free list
+/*!
+ * Return empty segments to the OS if the release rate was reached. The segments are detached
+ * under the lock and returned to the OS after it is released.
+ * \param root; Pointer to the allocator root
+ */
+static void ak_ca_release_os_mem(ak_ca_root* root)
+{
+    if (*(volatile ak_u32*)ak_as_ptr(root->release) < root->RELEASE_RATE) {
+        return;
     }
 
-    if (nextnode && ak_ca_is_free(nextnode->currinfo)) {
-        // coalesce forward
-        // update node and the footer
-        ak_alloc_node* n = (coalesce) ? prevnode : node;
-        ak_sz newsz = ak_ca_to_sz(n->currinfo) + ak_ca_to_sz(nextnode->currinfo) + sizeof(ak_alloc_node);
-        ak_ca_set_sz(ak_as_ptr(n->currinfo), newsz);
-        ak_ca_set_is_last(ak_as_ptr(n->currinfo), ak_ca_is_last(nextnode->currinfo));
-        ak_ca_update_footer(n);
-        AKMALLOC_ASSERT(ak_ca_is_last(n->currinfo) || (n->currinfo == ak_ca_next_node(nextnode)->previnfo));
-        coalesce += 2;
+    ak_ca_segment* detached = AK_NULLPTR;
+    ak_u32 ct = 0;
+    AK_CA_LOCK_ACQUIRE(root);
+    ak_ca_drain_pending_if_any(root);
+    while ((ct < root->MAX_SEGMENTS_TO_FREE) && (root->empty_root.fd != ak_as_ptr(root->empty_root))) {
+        ak_ca_segment* seg = root->empty_root.fd;
+        ak_ca_segment_unlink(seg);
+        seg->fd = detached;
+        detached = seg;
+        ++ct;
     }
+    root->nempty -= ct;
+    root->release = 0;
+    AK_CA_LOCK_RELEASE(root);
 
-    // update free lists
-    ak_alloc_node* tocheck = AK_NULLPTR;
-    switch (coalesce) {
-        case 0: {
-                // thread directly
-                ak_free_list_node* fl = (ak_free_list_node*)(node + 1);
-                ak_free_list_node_link(fl, root->free_root.fd, ak_as_ptr(root->free_root));
-            }
-            break;
-        case 1: {
-                // prevnode already threaded through
-                tocheck = prevnode;
-            }
-            break;
-        case 2: {
-                // copy free list entry from nextnode
-                ak_free_list_node* fl = (ak_free_list_node*)(node + 1);
-                ak_free_list_node* nextfl = (ak_free_list_node*)(nextnode + 1);
-                ak_free_list_node_link(fl, nextfl->fd, nextfl->bk);
-                tocheck = node;
-            }
-            break;
-        case 3: {
-                ak_free_list_node* nextfl = (ak_free_list_node*)(nextnode + 1);
-                ak_free_list_node_unlink(nextfl);
-                tocheck = prevnode;
-            }
-            break;
-        default:
-            AKMALLOC_ASSERT_ALWAYS(0 && "Should not get here!");
-            break;
+    while (detached) {
+        // the segment header lives in the segment
+        ak_ca_segment* next = detached->fd;
+        ak_os_free(detached->head, detached->sz);
+        detached = next;
     }
+}
 
-    // move to empty if segment is empty
+#define ak_ca_release_if_due(root)                                                      \
+  do {                                                                                  \
+    ak_ca_root* const rRD = (root);                                                     \
+    if (ak_unlikely(*(volatile ak_u32*)ak_as_ptr(rRD->release) >= rRD->RELEASE_RATE) && \
+        !rRD->DEFER_RELEASE) {                                                          \
+        ak_ca_release_os_mem(rRD);                                                      \
+    }                                                                                   \
+  } while (0)
 
-    if (tocheck && ak_ca_is_first(tocheck->currinfo) && ak_ca_is_last(tocheck->currinfo)) {
-        // remove free list entry
-        ak_free_list_node* fl = (ak_free_list_node*)(tocheck + 1);
-        ak_free_list_node_unlink(fl);
-        // actual size is in tocheck->previnfo
-        AKMALLOC_ASSERT(tocheck->previnfo == ak_ca_to_sz(tocheck->currinfo));
-        ak_ca_segment* seg = ak_ptr_cast(ak_ca_segment, ((char*)(tocheck + 1) + tocheck->previnfo));
-        AKMALLOC_ASSERT(tocheck->previnfo == (seg->sz - sizeof(ak_alloc_node) - sizeof(ak_ca_segment)));
-        ak_ca_segment_unlink(seg);
-        ak_ca_segment_link(seg, root->empty_root.fd, ak_as_ptr(root->empty_root));
-        ++(root->nempty); ++(root->release);
-        // check if we should free empties
-        if (root->release >= root->RELEASE_RATE) {
-            // release segment
-            ak_u32 nrem = ak_ca_return_os_mem(ak_as_ptr(root->empty_root), root->MAX_SEGMENTS_TO_FREE);
-            root->nempty -= nrem;
-            root->release = 0;
-        }
+/*!
+ * Return memory to the coalescing allocator root. If another thread holds the lock, the memory
+ * is queued for it or the next lock holder to return instead of waiting.
+ * \param root; Pointer to the allocator root
+ * \param m; The memory to return.
+ */
+ak_inline static void ak_ca_free(ak_ca_root* root, void* m)
+{
+    if (ak_unlikely(!AK_CA_LOCK_TRY(root))) {
+        ak_ca_free_pending(root, m);
+        return;
     }
-
+    ak_ca_drain_pending_if_any(root);
+    ak_ca_free_locked(root, m);
     AK_CA_LOCK_RELEASE(root);
+    ak_ca_release_if_due(root);
 }
 
 /*!
@@ -2329,6 +3872,14 @@ static void ak_ca_destroy(ak_ca_root* root)
     ak_ca_return_os_mem(ak_as_ptr(root->main_root), AK_U32_MAX);
     ak_ca_return_os_mem(ak_as_ptr(root->empty_root), AK_U32_MAX);
     root->nempty = root->release = 0;
+    root->PENDING = AK_NULLPTR;
+    root->nquick = 0;
+#if AK_CA_QUICK_BINS > 0
+    for (ak_sz i = 0; i != AK_CA_QUICK_BINS; ++i) {
+        root->quick_sz[i] = 0;
+        root->quick[i] = AK_NULLPTR;
+    }
+#endif
 }
 /********************** coalescing allocator end ************************/
 
@@ -2350,6 +3901,13 @@ static void ak_ca_destroy(ak_ca_root* root)
  * Multiple threads that allocate or free a size in a different size category do not contend
  * with each other. 
  *
+ * When locks are used, every thread also keeps a small cache of slab objects for each slab size
+ * (see \ref tcache). Most small allocations and frees are served from this cache without
+ * taking a lock, and the cache talks to the slabs in batches.
+ *
+ * With <tt>AKMALLOC_ARENAS</tt> threads are spread over several malloc states (see \ref arenas)
+ * so that they also do not contend on the same size category.
+ *
  * By default shared and static libraries have a thread safe malloc and free.
  *
  * Every allocation has a 8B header which contains a distinct bit mask allowing the allocator
@@ -2412,12 +3970,111 @@ static void ak_ca_destroy(ak_ca_root* root)
  * // works for ak_malloc
  * #define AKMALLOC_USE_LOCKS [0 | 1] // defaults to 1 for libraries
  *
+ * // lock used by the slab and coalescing allocators and for mmap-ed memory
+ * // AK_LOCK_POLICY_SPIN, AK_LOCK_POLICY_FUTEX (Linux), AK_LOCK_POLICY_TICKET or AK_LOCK_POLICY_MCS
+ * // the FIFO policies TICKET and MCS are for threads that do not outnumber cores, beyond that
+ * // they are much slower than SPIN and FUTEX, and only sleep instead of spinning on Linux
+ * // works for ak_slab, ak_ca_root, ak_malloc_state and ak_malloc
+ * #define AKMALLOC_LOCK_POLICY // default: AK_LOCK_POLICY_SPIN
+ *
+ * // whether to skip the allocator locks while the process has a single thread (glibc 2.32+)
+ * // works for ak_slab, ak_ca_root, ak_malloc_state and ak_malloc
+ * #define AKMALLOC_SINGLE_THREAD_FAST_PATH [0 | 1] // default: 1
+ *
+ * // number of spins before a futex lock sleeps or a ticket/MCS waiter yields
+ * #define AK_LOCK_SPINS_BEFORE_WAIT // default: 100
+ *
+ * // number of MCS locks one thread may hold at the same time
+ * #define AK_MCS_MAX_HELD // default: 4
+ *
  * // whether to use locks for ak_malloc_from_state() variety of APIs
  * // including malloc.h directly will set this based on AKMALLOC_USE_LOCKS
  * // works for ak_malloc_state
  * #define AK_MALLOCSTATE_USE_LOCKS // defined or undefined, default is undefined
  *
+ * // whether to keep a per-thread cache of small objects in front of the slabs
+ * // works for ak_malloc
+ * #define AKMALLOC_THREAD_CACHE [0 | 1] // defaults to 1 if locks are used
+ *
+ * // maximum number of objects held by a thread for each slab size
+ * // works for ak_malloc
+ * #define AK_TCACHE_CAPACITY // default: 64
+ *
+ * // whether to keep per-CPU magazines of small objects in front of the slabs (Linux only)
+ * // works for ak_malloc, replaces AKMALLOC_THREAD_CACHE
+ * #define AKMALLOC_CPU_CACHE [0 | 1] // default: 0
+ *
+ * // number of objects in a magazine
+ * // works for ak_malloc
+ * #define AK_MAGAZINE_SIZE // default: 30
+ *
+ * // maximum number of full magazines kept in the depot for each slab size
+ * // works for ak_malloc
+ * #define AK_DEPOT_MAX_FULL // default: 32
+ *
+ * // whether to bind threads to one of several malloc states (arenas)
+ * // works for ak_malloc
+ * #define AKMALLOC_ARENAS [0 | 1] // default: 0
+ *
+ * // number of arenas, 0 picks AK_ARENAS_PER_CPU times the number of CPUs (at most AK_MAX_ARENAS)
+ * // works for ak_malloc
+ * #define AKMALLOC_NUM_ARENAS // default: 0
+ * #define AK_ARENAS_PER_CPU   // default: 2
+ * #define AK_MAX_ARENAS       // default: 64
+ *
+ * // whether ak_free_async() and threads in async free mode queue frees for the maintenance thread
+ * // or ak_malloc_drain_async_frees()
+ * // works for ak_malloc
+ * #define AKMALLOC_ASYNC_FREE [0 | 1] // default: 1
+ *
+ * // number of objects retired with ak_free_deferred() that are kept together and freed at once
+ * // works for ak_malloc
+ * #define AK_EPOCH_BAG_SIZE // default: 62
+ *
+ * // whether to give every NUMA node its own arenas and place their pages on it (Linux only)
+ * // set AKMALLOC_NUMA_NODES in the environment to override the number of nodes
+ * // works for ak_malloc, enables AKMALLOC_ARENAS
+ * #define AKMALLOC_NUMA [0 | 1] // default: 0
+ *
+ * // number of nodes to pretend with AKMALLOC_NUMA, 0 reads the topology
+ * // the AKMALLOC_NUMA_NODES environment variable overrides it
+ * #define AKMALLOC_NUMA_NODES     // default: 0
+ *
+ * // whether slab objects are claimed and returned with atomic bitmap updates instead of under
+ * // the slab lock, empty slab pages are then kept until the allocator is destroyed
+ * // works for ak_malloc_state and ak_malloc
+ * #define AKMALLOC_SLAB_LOCKFREE [0 | 1] // default: 0
+ *
+ * // whether a small allocation may be served by one of the next larger slab sizes when the lock
+ * // of its own size is still busy after a few attempts, counted in ak_malloc_stats::slab_spills
+ * // works for ak_malloc_state, and for ak_malloc only if AKMALLOC_THREAD_CACHE and
+ * // AKMALLOC_CPU_CACHE are 0 since the caches refill in batches from their own slab size
+ * #define AKMALLOC_SLAB_SPILLOVER [0 | 1] // default: 0
+ * #define AK_SLAB_SPILL_TRIES             // default: 4
+ * #define AK_SLAB_SPILL_CLASSES           // default: 2
+ *
+ * // whether slab objects are told apart by the page map instead of a header word, so that small
+ * // requests are not rounded up to the next slab size for the header
+ * // works for ak_malloc_state and ak_malloc
+ * #define AKMALLOC_SLAB_HEADERLESS [0 | 1] // default: 1
+ *
+ * // whether requests larger than the slab sizes, up to 32KB, are served by slabs that span
+ * // several pages instead of by the coalescing allocators
+ * // works for ak_malloc_state and ak_malloc, requires AKMALLOC_SLAB_HEADERLESS
+ * #define AKMALLOC_SLAB_SPANS [0 | 1] // default: AKMALLOC_SLAB_HEADERLESS
+ *
+ * // distance between the offsets at which successive slabs of one size place their objects, so
+ * // that objects at the same index of different slabs map to different cache sets
+ * // must be a multiple of 16, 0 disables colouring
+ * // works for ak_slab, ak_malloc_state and ak_malloc
+ * #define AK_SLAB_COLOUR_STEP // default: AKMALLOC_CACHE_LINE_LENGTH
+ *
+ * // smallest number of bytes in a slab that spans several pages
+ * // works for ak_malloc_state and ak_malloc
+ * #define AK_SLAB_SPAN_SIZE // default: 64KB
+ *
  * // whether to always align allocations at 16 byte boundaries, slabs can do 8
+ * // when undefined, slab sizes up to 128 bytes are 8 bytes apart instead of 16
  * // works for ak_malloc_state and ak_malloc
  * #define AK_MIN_SLAB_ALIGN_16 // defined or undefined, default is undefined
  *
@@ -2429,6 +4086,15 @@ static void ak_ca_destroy(ak_ca_root* root)
  * // works for ak_slab, ak_malloc_state and ak_malloc
  * #define AK_SLAB_MAX_PAGES_TO_FREE // default: AK_SLAB_RELEASE_RATE
  *
+ * // number of partial page lists of a slab size, pages are sorted into them by occupancy and
+ * // allocation takes from the fullest so that sparse pages can drain and be released
+ * // works for ak_slab, ak_malloc_state and ak_malloc
+ * #define AK_SLAB_PARTIAL_BUCKETS // default: 4, at most 32
+ *
+ * // number of released slab pages kept for reuse by any slab size before they are returned to the OS
+ * // works for ak_slab, ak_malloc_state and ak_malloc
+ * #define AK_SLAB_PAGE_DEPOT_SIZE // default: 256, 0 with AKMALLOC_NUMA
+ *
  * // multiples of this size are used to obtain memory from the OS for coalescing allocators
  * // works for ak_ca_root, ak_malloc_state and ak_malloc
  * #define AK_COALESCE_SEGMENT_GRANULARITY // default is 256KB for ak_malloc and ak_malloc_state
@@ -2442,6 +4108,14 @@ static void ak_ca_destroy(ak_ca_root* root)
  * // works for ak_ca_root, ak_malloc_state and ak_malloc
  * #define AKMALLOC_COALESCING_ALLOC_MAX_PAGES_TO_FREE // default: AKMALLOC_COALESCING_ALLOC_RELEASE_RATE
  *
+ * // number of exact size quick lists per coalescing allocator, 0 coalesces on every free
+ * // works for ak_ca_root, ak_malloc_state and ak_malloc
+ * #define AK_CA_QUICK_BINS // default: 16
+ *
+ * // number of chunks held in the quick lists after which they are coalesced
+ * // works for ak_ca_root, ak_malloc_state and ak_malloc
+ * #define AK_CA_QUICK_MAX // default: 64
+ *
  * // at what size to resort to using mmap() like system calls
  * // works for ak_malloc_state and ak_malloc
  * #define MMAP_SIZE // default is system determined, e.g. 65536
@@ -2478,7 +4152,7 @@ static void ak_memcpy(void* d, const void* s, ak_sz sz)
 // to distinguish slabs from coalesced outputs, and mmap-outputs.
 //
 // xxx0 - coalesce
-// 0101 - slab
+// 0101 - slab (only without AK_SLAB_HEADERLESS)
 // 1001 - mmap
 #define ak_alloc_type_bits(p) \
   ((*(((const ak_sz*)(p)) - 1)) & (AK_COALESCE_ALIGN - 1))
@@ -2494,19 +4168,51 @@ static void ak_memcpy(void* d, const void* s, ak_sz sz)
 
 #define ak_alloc_mark_coalesce(p) ((void)(p))
 
-#define ak_alloc_mark_slab(p) \
+#if defined(AK_SLAB_HEADERLESS)
+#  define ak_alloc_mark_slab(p) ((void)(p))
+#else
+#  define ak_alloc_mark_slab(p) \
   *(((ak_sz*)(p)) - 1) = ((ak_sz)10)
+#endif
 
 #define ak_alloc_mark_mmap(p) \
   *(((ak_sz*)(p)) - 1) = ((ak_sz)9)
 
-#if defined(AK_MIN_SLAB_ALIGN_16)
+// Without a header, slab objects are told apart by the page map, so the type bits of memory
+// must only be read once it is known not to be a slab object.
+#if defined(AK_SLAB_HEADERLESS)
+#  define ak_alloc_is_slab(p) ((ak_pagemap_get((p)) & AK_PAGEMAP_SLAB) != 0)
+#else
+#  define ak_alloc_is_slab(p) ak_alloc_type_slab(ak_alloc_type_bits((p)))
+#endif
+
+/*
+ * Unless all allocations must be 16-byte aligned, slab sizes up to AK_SLAB_TINY_MAX are 8 bytes
+ * apart. Only slab sizes that are odd multiples of 8 give 8-byte aligned objects, and no object
+ * of such a size can need more.
+ */
+#if !defined(AK_MIN_SLAB_ALIGN_16)
+#  define AK_SLAB_TINY_SIZES
+#  define AK_SLAB_TINY_MAX 128
+#  define ak_slab_aligned_size(x) \
+    (((x) <= AK_SLAB_TINY_MAX) ? ((x) ? (((x) + 7) & ~((ak_sz)7)) : 8) : ak_ca_aligned_size((x)))
+#else
+#  define ak_slab_aligned_size(x) ak_ca_aligned_size((x))
+#endif
+
+#if defined(AK_SLAB_HEADERLESS)
+// slab objects are used whole
+#  define ak_slab_mod_sz(x) (ak_slab_aligned_size((x)))
+#  define ak_slab_alloc_2_mem(x) ((ak_sz*)(x))
+#  define ak_slab_mem_2_alloc(x) ((ak_sz*)(x))
+#  define ak_slab_usable_size(x) (x)
+#elif defined(AK_MIN_SLAB_ALIGN_16)
 #  define ak_slab_mod_sz(x) (ak_ca_aligned_size((x)) + AK_COALESCE_ALIGN)
 #  define ak_slab_alloc_2_mem(x) (((ak_sz*)x) + (AK_COALESCE_ALIGN / sizeof(ak_sz)))
 #  define ak_slab_mem_2_alloc(x) (((ak_sz*)x) - (AK_COALESCE_ALIGN / sizeof(ak_sz)))
 #  define ak_slab_usable_size(x) ((x) - AK_COALESCE_ALIGN)
 #else
-#  define ak_slab_mod_sz(x) (ak_ca_aligned_size((x) + sizeof(ak_sz)))
+#  define ak_slab_mod_sz(x) (ak_slab_aligned_size((x) + sizeof(ak_sz)))
 #  define ak_slab_alloc_2_mem(x) (((ak_sz*)x) + 1)
 #  define ak_slab_mem_2_alloc(x) (((ak_sz*)x) - 1)
 #  define ak_slab_usable_size(x) ((x) - sizeof(ak_sz))
@@ -2528,6 +4234,27 @@ static void ak_memcpy(void* d, const void* s, ak_sz sz)
 #endif
 
 
+#if defined(AK_SLAB_TINY_SIZES)
+
+#define NSLABS 24
+
+/*!
+ * Sizes for the slabs in an \c ak_malloc_state
+ */
+static const ak_sz SLAB_SIZES[NSLABS] = {
+     8,   16,   24,   32,   40,   48,   56,   64,
+    72,   80,   88,   96,  104,  112,  120,  128,
+   144,  160,  176,  192,  208,  224,  240,  256
+};
+
+/*!
+ * Index into \c SLAB_SIZES for a slab size
+ */
+#define ak_slab_size_to_index(sz) \
+  (((sz) <= AK_SLAB_TINY_MAX) ? (((sz) >> 3) - 1) : (((sz) >> 4) + (AK_SLAB_TINY_MAX >> 4) - 1))
+
+#else
+
 #define NSLABS 16
 
 /*!
@@ -2538,6 +4265,43 @@ static const ak_sz SLAB_SIZES[NSLABS] = {
    144,  160,  176,  192,  208,  224,  240,  256
 };
 
+/*!
+ * Index into \c SLAB_SIZES for a slab size
+ */
+#define ak_slab_size_to_index(sz) (((sz) >> 4) - 1)
+
+#endif
+
+#if defined(AK_SLAB_SPANS)
+
+#define NSPANS 28
+
+/* largest request served by slabs that span several pages */
+#define MAX_SPAN_REQUEST 32768
+
+/*!
+ * Sizes for the slabs that span several pages in an \c ak_malloc_state, four for every doubling
+ */
+static const ak_sz SPAN_SIZES[NSPANS] = {
+      320,   384,   448,   512,   640,   768,   896,  1024,
+     1280,  1536,  1792,  2048,  2560,  3072,  3584,  4096,
+     5120,  6144,  7168,  8192, 10240, 12288, 14336, 16384,
+    20480, 24576, 28672, 32768
+};
+
+/*!
+ * Index into \c SPAN_SIZES for a request larger than \c MIN_SMALL_REQUEST
+ */
+ak_inline static ak_sz ak_span_size_to_index(ak_sz sz)
+{
+    AKMALLOC_ASSERT(sz > MIN_SMALL_REQUEST && sz <= MAX_SPAN_REQUEST);
+    const ak_bitset32 v = (ak_bitset32)(sz - 1);
+    const int lg = 31 - ak_bitset_num_leading_zeros(&v);
+    return (ak_sz)(((lg - 8) << 2) + (int)((sz - 1) >> (lg - 2)) - 4);
+}
+
+#endif
+
 #define NCAROOTS 8
 
 /*!
@@ -2557,11 +4321,18 @@ typedef struct ak_malloc_state_tag ak_malloc_state;
 struct ak_malloc_state_tag
 {
     ak_sz         init;             /**< whether initialized */
-    ak_slab_root  slabs[NSLABS];    /**< slabs of different sizes */
+    ak_slab_root  slabs[NSLABS];    /**< slabs of different sizes, each on its own cache lines */
+#if defined(AK_SLAB_SPANS)
+    ak_slab_root  spans[NSPANS];    /**< slabs spanning several pages for larger sizes */
+#endif
     ak_ca_root    ca[NCAROOTS];     /**< coalescing allocators of different size ranges */
-    ak_ca_segment map_root;         /**< root of list of mmap-ed segments */
 
+    AK_CACHE_ALIGNED
+    ak_ca_segment map_root;         /**< root of list of mmap-ed segments */
     AKMALLOC_LOCK_DEFINE(MAP_LOCK); /**< lock for mmap-ed regions if locks are enabled */
+
+    AK_CACHE_ALIGNED
+    ak_sz         nspills;          /**< slab allocations served by a larger slab size */
 };
 
 #if !defined(AKMALLOC_COALESCING_ALLOC_RELEASE_RATE)
@@ -2574,38 +4345,133 @@ struct ak_malloc_state_tag
 
 static void ak_try_reclaim_memory(ak_malloc_state* m)
 {
+#if !defined(AK_SLAB_LOCKFREE)
     // for each slab, reclaim empty pages
     for (ak_sz i = 0; i < NSLABS; ++i) {
         ak_slab_root* s = ak_as_ptr(m->slabs[i]);
-        ak_slab_release_pages(s, ak_as_ptr(s->empty_root), AK_U32_MAX);
-        s->nempty = 0;
-        s->release = 0;
+        ak_slab_release_empty(s, AK_U32_MAX, 0);
+        ak_slab_release_fresh(s);
+    }
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i < NSPANS; ++i) {
+        ak_slab_root* s = ak_as_ptr(m->spans[i]);
+        ak_slab_release_empty(s, AK_U32_MAX, 0);
+        ak_slab_release_fresh(s);
     }
+#endif
+#endif
+    ak_slab_depot_release();
     // return unused segments in ca
     for (ak_sz i = 0; i < NCAROOTS; ++i) {
         ak_ca_root* ca = ak_as_ptr(m->ca[i]);
+        AK_CA_LOCK_ACQUIRE(ca);
+        ak_ca_drain_pending_if_any(ca);
+        ak_ca_consolidate_locked(ca);
         ak_ca_return_os_mem(ak_as_ptr(ca->empty_root), AK_U32_MAX);
         ca->nempty = 0;
         ca->release = 0;
+        AK_CA_LOCK_RELEASE(ca);
     }
 
     // all memory in mmap-ed regions is being used. we return pages immediately
     // when they are free'd.
 }
 
+#if AKMALLOC_SLAB_SPILLOVER
+/*!
+ * Attempt to allocate memory from the slab allocator root without waiting for its lock.
+ * \param root; Pointer to the allocator root
+ * \param pbusy; Set to non-zero if another thread held the lock, and to \c 0 otherwise
+ *
+ * \return \c 0 if the lock was busy or on failure, else pointer to at least \p root->sz bytes of
+ * memory.
+ */
+ak_inline static void* ak_slab_try_alloc(ak_slab_root* root, int* pbusy)
+{
+#if defined(AK_SLAB_LOCKFREE)
+    *pbusy = 0;
+    return ak_slab_alloc_lockfree(root);
+#else
+    if (!AK_SLAB_LOCK_TRY(root)) {
+        *pbusy = 1;
+        return AK_NULLPTR;
+    }
+    *pbusy = 0;
+    void* mem = ak_slab_alloc_locked(root);
+    AK_SLAB_LOCK_RELEASE(root);
+    if (ak_unlikely(!mem)) {
+        mem = ak_slab_alloc_refill(root);
+    }
+    return mem;
+#endif
+}
+
+/*!
+ * Allocate from slab size \p idx, or from one of the next larger sizes if its lock stays busy.
+ * Only single allocations from the state get here. The thread and CPU caches refill in batches
+ * with ak_slab_alloc_n() from their own size and wait for its lock, so with either cache enabled
+ * the small sizes served by the cache never spill.
+ * \param m; The allocator
+ * \param idx; Index of the slab size
+ *
+ * \return \c 0 on failure, else pointer to at least \c SLAB_SIZES[idx] bytes of memory.
+ */
+static void* ak_slab_alloc_spill(ak_malloc_state* m, ak_sz idx)
+{
+    int busy = 0;
+    for (int t = 0; t < AK_SLAB_SPILL_TRIES; ++t) {
+        void* mem = ak_slab_try_alloc(ak_as_ptr(m->slabs[idx]), &busy);
+        if (!busy) {
+            return mem;
+        }
+        ak_cpu_relax();
+    }
+    const ak_sz last = ((idx + AK_SLAB_SPILL_CLASSES) < NSLABS) ? (idx + AK_SLAB_SPILL_CLASSES) : (NSLABS - 1);
+    for (ak_sz j = idx + 1; j <= last; ++j) {
+#if defined(AK_SLAB_TINY_SIZES)
+        // objects of an odd multiple of 8 bytes are only 8-byte aligned
+        if ((SLAB_SIZES[j] & 15) && !(SLAB_SIZES[idx] & 15)) {
+            continue;
+        }
+#endif
+        void* mem = ak_slab_try_alloc(ak_as_ptr(m->slabs[j]), &busy);
+        if (!busy && mem) {
+            ak_atomic_fetch_add_sz(ak_as_ptr(m->nspills), 1);
+            return mem;
+        }
+    }
+    // all candidates are busy, wait for our own size
+    return ak_slab_alloc(ak_as_ptr(m->slabs[idx]));
+}
+#endif
+
 ak_inline static void* ak_try_slab_alloc(ak_malloc_state* m, size_t sz)
 {
-    AKMALLOC_ASSERT(sz % AK_COALESCE_ALIGN == 0);
-    ak_sz idx = (sz >> 4) - 1;
+    AKMALLOC_ASSERT(SLAB_SIZES[ak_slab_size_to_index(sz)] == sz);
+    ak_sz idx = ak_slab_size_to_index(sz);
+#if AKMALLOC_SLAB_SPILLOVER
+    ak_sz* mem = (ak_sz*)ak_slab_alloc_spill(m, idx);
+#else
     ak_sz* mem = (ak_sz*)ak_slab_alloc(ak_as_ptr(m->slabs[idx]));
+#endif
     if (ak_likely(mem)) {
         ak_alloc_mark_slab(ak_slab_alloc_2_mem(mem)); // we overallocate
-        AKMALLOC_ASSERT(ak_alloc_type_slab(ak_alloc_type_bits(ak_slab_alloc_2_mem(mem))));
+        AKMALLOC_ASSERT(ak_alloc_is_slab(ak_slab_alloc_2_mem(mem)));
         mem = ak_slab_alloc_2_mem(mem);
     }
     return mem;
 }
 
+#if defined(AK_SLAB_SPANS)
+ak_inline static void* ak_try_span_alloc(ak_malloc_state* m, size_t sz)
+{
+    const ak_sz idx = ak_span_size_to_index(sz);
+    void* mem = ak_slab_alloc(ak_as_ptr(m->spans[idx]));
+    AKMALLOC_ASSERT(!mem || ak_alloc_is_slab(mem));
+    return mem;
+}
+#endif
+
 ak_inline static void* ak_try_coalesce_alloc(ak_malloc_state* m, ak_ca_root* proot, size_t sz)
 {
     ak_sz* mem = (ak_sz*)ak_ca_alloc(proot, sz);
@@ -2618,16 +4484,24 @@ ak_inline static void* ak_try_coalesce_alloc(ak_malloc_state* m, ak_ca_root* pro
 
 ak_inline static void* ak_try_alloc_mmap(ak_malloc_state* m, size_t sz)
 {
-    AKMALLOC_LOCK_ACQUIRE(ak_as_ptr(m->MAP_LOCK));
     ak_ca_segment* mem = (ak_ca_segment*)ak_os_alloc(sz);
+#if defined(AK_USE_PAGEMAP)
+    // record the owner, the header and the start of the memory are in the first page
+    if (ak_likely(mem) && ak_unlikely(!ak_pagemap_set_range(mem, AKMALLOC_DEFAULT_PAGE_SIZE, (ak_sz)m))) {
+        ak_os_free(mem, sz);
+        mem = AK_NULLPTR;
+    }
+#endif
     if (ak_likely(mem)) {
         ak_alloc_mark_mmap(mem + 1);
         AKMALLOC_ASSERT(ak_alloc_type_mmap(ak_alloc_type_bits(mem + 1)));
         mem->sz = sz;
+        // only the list is protected by the lock
+        AKMALLOC_LOCK_ACQUIRE(ak_as_ptr(m->MAP_LOCK));
         ak_ca_segment_link(mem, m->map_root.fd, ak_as_ptr(m->map_root));
+        AKMALLOC_LOCK_RELEASE(ak_as_ptr(m->MAP_LOCK));
         mem += 1;
     }
-    AKMALLOC_LOCK_RELEASE(ak_as_ptr(m->MAP_LOCK));
 
     return mem;
 }
@@ -2644,6 +4518,34 @@ ak_inline static ak_ca_root* ak_find_ca_root(ak_malloc_state* m, ak_sz sz)
     return ak_as_ptr(m->ca[i]);
 }
 
+/*!
+ * Find the coalescing allocator that owns the allocated memory \p mem.
+ */
+ak_inline static ak_ca_root* ak_find_ca_owner(ak_malloc_state* m, const void* mem)
+{
+#if defined(AK_USE_PAGEMAP)
+    (void)m;
+    return (ak_ca_root*)ak_pagemap_get(mem);
+#else
+    const ak_alloc_node* n = ((const ak_alloc_node*)mem) - 1;
+    return ak_find_ca_root(m, ak_ca_to_sz(n->currinfo));
+#endif
+}
+
+/*!
+ * Find the malloc state that owns the mmap-ed memory \p mem.
+ */
+ak_inline static ak_malloc_state* ak_find_mmap_owner(ak_malloc_state* m, const void* mem)
+{
+#if defined(AK_USE_PAGEMAP)
+    (void)m;
+    return (ak_malloc_state*)ak_pagemap_get(mem);
+#else
+    (void)mem;
+    return m;
+#endif
+}
+
 ak_inline static void* ak_try_alloc(ak_malloc_state* m, size_t sz)
 {
     void* retmem = AK_NULLPTR;
@@ -2651,6 +4553,11 @@ ak_inline static void* ak_try_alloc(ak_malloc_state* m, size_t sz)
     if (modsz <= MIN_SMALL_REQUEST) {
         retmem = ak_try_slab_alloc(m, modsz);
         DBG_PRINTF("a,slab,%p,%llu\n", retmem, modsz);
+#if defined(AK_SLAB_SPANS)
+    } else if (sz <= MAX_SPAN_REQUEST) {
+        retmem = ak_try_span_alloc(m, sz);
+        DBG_PRINTF("a,span,%p,%llu\n", retmem, sz);
+#endif
     } else if (sz < MMAP_SIZE) {
         const ak_sz alnsz = ak_ca_aligned_size(sz);
         ak_ca_root* proot = ak_find_ca_root(m, sz);
@@ -2722,6 +4629,11 @@ static void ak_malloc_init_state(ak_malloc_state* s)
     for (ak_sz i = 0; i != NSLABS; ++i) {
         ak_slab_init_root_default(ak_as_ptr(s->slabs[i]), SLAB_SIZES[i]);
     }
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i != NSPANS; ++i) {
+        ak_slab_init_root_span(ak_as_ptr(s->spans[i]), SPAN_SIZES[i]);
+    }
+#endif
 
     for (ak_sz i = 0; i != NCAROOTS; ++i) {
         ak_ca_init_root(ak_as_ptr(s->ca[i]), AKMALLOC_COALESCING_ALLOC_RELEASE_RATE, AKMALLOC_COALESCING_ALLOC_MAX_PAGES_TO_FREE);
@@ -2730,9 +4642,51 @@ static void ak_malloc_init_state(ak_malloc_state* s)
     ak_ca_segment_link(ak_as_ptr(s->map_root), ak_as_ptr(s->map_root), ak_as_ptr(s->map_root));
 
     AKMALLOC_LOCK_INIT(ak_as_ptr(s->MAP_LOCK));
+    s->nspills = 0;
     s->init = 1;
 }
 
+/*!
+ * Choose whether frees release memory to the OS themselves, or leave it for
+ * ak_malloc_release_deferred_in_state().
+ * \param m; Pointer to the allocator
+ * \param defer; Non-zero to defer releasing memory
+ */
+static void ak_malloc_state_defer_release(ak_malloc_state* m, int defer)
+{
+    for (ak_sz i = 0; i != NSLABS; ++i) {
+        *(volatile ak_u32*)ak_as_ptr(m->slabs[i].DEFER_RELEASE) = defer ? 1 : 0;
+    }
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i != NSPANS; ++i) {
+        *(volatile ak_u32*)ak_as_ptr(m->spans[i].DEFER_RELEASE) = defer ? 1 : 0;
+    }
+#endif
+    for (ak_sz i = 0; i != NCAROOTS; ++i) {
+        *(volatile ak_u32*)ak_as_ptr(m->ca[i].DEFER_RELEASE) = defer ? 1 : 0;
+    }
+}
+
+/*!
+ * Return memory to the OS for every allocator whose release rate was reached while releasing
+ * was deferred. No lock is held while memory is returned.
+ * \param m; Pointer to the allocator
+ */
+static void ak_malloc_release_deferred_in_state(ak_malloc_state* m)
+{
+    for (ak_sz i = 0; i != NSLABS; ++i) {
+        ak_slab_release_os_mem(ak_as_ptr(m->slabs[i]));
+    }
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i != NSPANS; ++i) {
+        ak_slab_release_os_mem(ak_as_ptr(m->spans[i]));
+    }
+#endif
+    for (ak_sz i = 0; i != NCAROOTS; ++i) {
+        ak_ca_release_os_mem(ak_as_ptr(m->ca[i]));
+    }
+}
+
 /*!
  * Destroy the private malloc like allocator and return all memory to the OS.
  * \param m; Pointer to the allocator
@@ -2742,6 +4696,11 @@ static void ak_malloc_destroy_state(ak_malloc_state* m)
     for (ak_sz i = 0; i < NSLABS; ++i) {
         ak_slab_destroy(ak_as_ptr(m->slabs[i]));
     }
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i < NSPANS; ++i) {
+        ak_slab_destroy(ak_as_ptr(m->spans[i]));
+    }
+#endif
     for (ak_sz i = 0; i < NCAROOTS; ++i) {
         ak_ca_destroy(ak_as_ptr(m->ca[i]));
     }
@@ -2784,22 +4743,23 @@ ak_inline static void ak_free_to_state(ak_malloc_state* m, void* mem)
 #if defined(AKMALLOC_DEBUG_PRINT)
         ak_sz ussize = ak_malloc_usable_size_in_state(mem);
 #endif/*defined(AKMALLOC_DEBUG_PRINT)*/
-        ak_sz ty = ak_alloc_type_bits(mem);
-        if (ak_alloc_type_slab(ty)) {
+        if (ak_alloc_is_slab(mem)) {
             DBG_PRINTF("d,slab,%p,%llu\n", mem, ussize);
             ak_slab_free(ak_slab_mem_2_alloc(mem));
-        } else if (ak_alloc_type_mmap(ty)) {
+        } else if (ak_alloc_type_mmap(ak_alloc_type_bits(mem))) {
             DBG_PRINTF("d,mmap,%p,%llu\n", mem, ussize);
-            AKMALLOC_LOCK_ACQUIRE(ak_as_ptr(m->MAP_LOCK));
+            m = ak_find_mmap_owner(m, mem);
             ak_ca_segment* seg = ((ak_ca_segment*)mem) - 1;
+            AKMALLOC_LOCK_ACQUIRE(ak_as_ptr(m->MAP_LOCK));
             ak_ca_segment_unlink(seg);
-            ak_os_free(seg, seg->sz);
             AKMALLOC_LOCK_RELEASE(ak_as_ptr(m->MAP_LOCK));
+            ak_os_free(seg, seg->sz);
         } else {
-            AKMALLOC_ASSERT(ak_alloc_type_coalesce(ty));
+            AKMALLOC_ASSERT(ak_alloc_type_coalesce(ak_alloc_type_bits(mem)));
             const ak_alloc_node* n = ((const ak_alloc_node*)mem) - 1;
             const ak_sz alnsz = ak_ca_to_sz(n->currinfo);
-            ak_ca_root* proot = ak_find_ca_root(m, alnsz);
+            ak_ca_root* proot = ak_find_ca_owner(m, mem);
+            (void)alnsz;
             DBG_PRINTF("d,ca[%d],%p,%llu\n", (int)(proot-ak_as_ptr(m->ca[0])), mem, alnsz);
             ak_ca_free(proot, mem);
         }
@@ -2807,206 +4767,1467 @@ ak_inline static void ak_free_to_state(ak_malloc_state* m, void* mem)
 }
 
 /*!
- * Attempt to grow memory at the region pointed to by \p p to a size \p newsz without relocation.
- * \param m; The allocator
- * \param mem; Memory to grow
- * \param newsz; New size to grow to
- *
- * \return \c NULL if no memory is available, or \p mem with at least \p newsz bytes.
+ * Attempt to grow memory at the region pointed to by \p p to a size \p newsz without relocation.
+ * \param m; The allocator
+ * \param mem; Memory to grow
+ * \param newsz; New size to grow to
+ *
+ * \return \c NULL if no memory is available, or \p mem with at least \p newsz bytes.
+ */
+ak_inline static void* ak_realloc_in_place_from_state(ak_malloc_state* m, void* mem, size_t newsz)
+{
+    const ak_sz usablesize = ak_malloc_usable_size_in_state(mem);
+    if (usablesize >= newsz) {
+        return mem;
+    }
+    if (!ak_alloc_is_slab(mem) && ak_alloc_type_coalesce(ak_alloc_type_bits(mem))) {
+        AKMALLOC_ASSERT(!ak_ca_is_free((ak_ptr_cast(ak_alloc_node, mem) - 1)->currinfo));
+        // check if there is a free next, if so, maybe merge
+        ak_ca_root* proot = ak_find_ca_owner(m, mem);
+        if (ak_ca_realloc_in_place(proot, mem, newsz)) {
+            return mem;
+        }
+    }
+    return AK_NULLPTR;
+}
+
+/*!
+ * Attempt to grow memory at the region pointed to by \p p to a size \p newsz.
+ * \param m; The allocator
+ * \param mem; Memory to grow
+ * \param newsz; New size to grow to
+ *
+ * This function will copy the old bytes to a new memory location if the old memory cannot be
+ * grown in place, and will free the old memory. If no more memory is available it will not
+ * destroy the old memory.
+ *
+ * \return \c NULL if no memory is available, or a pointer to memory with at least \p newsz bytes.
+ */
+static void* ak_realloc_from_state(ak_malloc_state* m, void* mem, size_t newsz)
+{
+    if (ak_unlikely(!mem)) {
+        return ak_malloc_from_state(m, newsz);
+    }
+
+    if (ak_realloc_in_place_from_state(m, mem, newsz)) {
+        return mem;
+    }
+
+    void* newmem = ak_malloc_from_state(m, newsz);
+    if (!newmem) {
+        return AK_NULLPTR;
+    }
+    if (ak_likely(mem)) {
+        ak_memcpy(newmem, mem, ak_malloc_usable_size_in_state(mem));
+        ak_free_to_state(m, mem);
+    }
+    return newmem;
+}
+
+
+/*!
+ * Return the usable size of the memory region pointed to by \p p.
+ * \param mem; Pointer to the memory to determize size of.
+ *
+ * \return The number of bytes that can be written to in the region.
+ */
+ak_inline static size_t ak_malloc_usable_size_in_state(const void* mem)
+{
+    if (ak_likely(mem)) {
+        if (ak_alloc_is_slab(mem)) {
+            const ak_slab* slab = ak_slab_of(mem);
+            return ak_slab_usable_size(slab->root->sz);
+        } else if (ak_alloc_type_mmap(ak_alloc_type_bits(mem))) {
+            return (((const ak_ca_segment*)mem) - 1)->sz - sizeof(ak_ca_segment);
+        } else {
+            AKMALLOC_ASSERT(ak_alloc_type_coalesce(ak_alloc_type_bits(mem)));
+            const ak_alloc_node* n = ((const ak_alloc_node*)mem) - 1;
+            AKMALLOC_ASSERT(!ak_ca_is_free(n->currinfo));
+            return ak_ca_to_sz(n->currinfo);
+        }
+    } else {
+        return 0;
+    }
+}
+
+/*!
+ * Attempt to allocate memory containing at least \p n bytes at an address which is
+ * a multiple of \p aln. \p aln must be a power of two. \p sz must be a multiple of \p aln.
+ * \param m; The allocator
+ * \param aln; The alignment
+ * \param sz; The size for the allocation
+ *
+ * \return \c 0 on failure, else pointer to at least \p n bytes of memory at an aligned address.
+ */
+static void* ak_aligned_alloc_from_state(ak_malloc_state* m, size_t aln, size_t sz)
+{
+    if (aln <= AK_COALESCE_ALIGN) {
+        return ak_malloc_from_state(m, sz);
+    }
+    if ((aln & AK_SZ_ONE) || (aln & (aln - 1))) {
+        size_t a = AK_COALESCE_ALIGN << 1;
+        while (a < aln)  {
+            a  = (a << 1);
+        }
+        aln = a;
+    }
+    return ak_aligned_alloc_from_state_no_checks(m, aln, sz);
+}
+
+#define AK_EINVAL 22
+#define AK_ENOMEM 12
+
+/*!
+ * Attempt to allocate memory containing at least \p n bytes at an address which is
+ * a multiple of \p aln and assign the address to \p *pmem. \p aln must be a power of two and
+ * a multiple of \c sizeof(void*).
+ * \param m; The allocator
+ * \param pmem; The address where the memory address should be writted.
+ * \param aln; The alignment
+ * \param sz; The size for the allocation
+ *
+ * \return \c 0 on success, 12 if no more memory is available, and 22 if \p aln was not a power
+ * of two and a multiple of \c sizeof(void*)
+ */
+static int ak_posix_memalign_from_state(ak_malloc_state* m, void** pmem, size_t aln, size_t sz)
+{
+    void* mem = AK_NULLPTR;
+    if (aln == AK_COALESCE_ALIGN) {
+        // a multiple of 16 bytes does not use a slab size with 8-byte aligned objects
+        mem = ak_malloc_from_state(m, ak_ca_aligned_size(sz));
+    } else {
+        ak_sz div = (aln / sizeof(ak_sz));
+        ak_sz rem = (aln & (sizeof(ak_sz)));
+        if (rem != 0 || div == 0 || (div & (div - AK_SZ_ONE)) != 0) {
+            return AK_EINVAL;
+        }
+        aln = (aln <= AK_COALESCE_ALIGN) ? AK_COALESCE_ALIGN : aln;
+        mem = ak_aligned_alloc_from_state_no_checks(m, aln, sz);
+    }
+
+    if (!mem) {
+        return AK_ENOMEM;
+    }
+
+    *pmem = mem;
+    return 0;
+}
+
+/*!
+ * Attempt to allocate \p n blocks of memory containing at least \p sz bytes each.
+ * \param m; The allocator
+ * \param sz; The size for each allocation
+ * \param n; Number of allocations
+ * \param out; Array that receives the allocated pointers
+ *
+ * \return The number of pointers written to \p out, which is less than \p n if no more memory is
+ * available.
+ */
+static ak_sz ak_malloc_batch_from_state(ak_malloc_state* m, size_t sz, size_t n, void** out)
+{
+    AKMALLOC_ASSERT(m->init);
+    const ak_sz modsz = ak_slab_mod_sz(sz);
+    ak_sz i = 0;
+    ak_slab_root* root = AK_NULLPTR;
+    if (modsz <= MIN_SMALL_REQUEST) {
+        root = ak_as_ptr(m->slabs[ak_slab_size_to_index(modsz)]);
+#if defined(AK_SLAB_SPANS)
+    } else if (sz <= MAX_SPAN_REQUEST) {
+        root = ak_as_ptr(m->spans[ak_span_size_to_index(sz)]);
+#endif
+    }
+    if (root) {
+        while (i < n) {
+            const ak_sz rem = n - i;
+            const ak_u32 req = (rem > AK_U32_MAX) ? AK_U32_MAX : (ak_u32)rem;
+            const ak_u32 got = ak_slab_alloc_n(root, out + i, req);
+            for (ak_u32 j = 0; j < got; ++j) {
+                ak_sz* mem = ak_slab_alloc_2_mem(out[i + j]);
+                ak_alloc_mark_slab(mem);
+                out[i + j] = mem;
+            }
+            i += got;
+            if (ak_unlikely(got < req)) {
+                break;
+            }
+        }
+    }
+    // larger sizes, or whatever the slabs could not provide
+    for (; i < n; ++i) {
+        out[i] = ak_malloc_from_state(m, sz);
+        if (ak_unlikely(!out[i])) {
+            break;
+        }
+    }
+    return i;
+}
+
+/*!
+ * Return several blocks of memory to the allocator. Consecutive blocks from the same slab
+ * allocator or coalescing allocator are returned under one acquisition of its lock, and a slab
+ * page is moved between lists at most once for each run of blocks that it holds.
+ * \param m; The allocator
+ * \param p; Array of pointers to the memory to return, \c NULL entries are skipped
+ * \param n; Number of pointers in \p p
+ */
+static void ak_free_batch_to_state(ak_malloc_state* m, void** p, ak_sz n)
+{
+    ak_sz i = 0;
+    while (i < n) {
+        void* mem = p[i];
+        if (ak_unlikely(!mem)) {
+            ++i;
+            continue;
+        }
+        if (ak_alloc_is_slab(mem)) {
+#if defined(AK_SLAB_LOCKFREE)
+            ak_slab_free(ak_slab_mem_2_alloc(mem));
+            ++i;
+#else
+            ak_slab_root* root = ak_slab_of(mem)->root;
+            AK_SLAB_LOCK_ACQUIRE(root);
+            ak_slab_merge_remote_if_any(root);
+            do {
+                // the run of pointers into this page
+                ak_slab* slab = ak_slab_of(p[i]);
+                do {
+                    ak_slab_mark_free(root, slab, ak_slab_mem_2_alloc(p[i]));
+                    ++i;
+                } while ((i < n) && p[i] && (ak_slab_of(p[i]) == slab));
+                ak_slab_relink(root, slab);
+            } while ((i < n) && p[i] &&
+                     ak_alloc_is_slab(p[i]) &&
+                     (ak_slab_of(p[i])->root == root));
+            AK_SLAB_LOCK_RELEASE(root);
+            ak_slab_release_if_due(root);
+#endif
+        } else if (ak_alloc_type_coalesce(ak_alloc_type_bits(mem))) {
+            ak_ca_root* proot = ak_find_ca_owner(m, mem);
+            AK_CA_LOCK_ACQUIRE(proot);
+            ak_ca_drain_pending_if_any(proot);
+            do {
+                ak_ca_free_locked(proot, p[i]);
+                ++i;
+            } while ((i < n) && p[i] &&
+                     !ak_alloc_is_slab(p[i]) &&
+                     ak_alloc_type_coalesce(ak_alloc_type_bits(p[i])) &&
+                     (ak_find_ca_owner(m, p[i]) == proot));
+            AK_CA_LOCK_RELEASE(proot);
+            ak_ca_release_if_due(proot);
+        } else {
+            ak_free_to_state(m, mem);
+            ++i;
+        }
+    }
+}
+
+/*!
+ * Add the statistics of an allocator to \p st.
+ * \param m; The allocator
+ * \param st; Statistics to add to
+ */
+static void ak_malloc_add_stats_in_state(ak_malloc_state* m, ak_malloc_stats* st)
+{
+    st->slab_spills += *(volatile ak_sz*)ak_as_ptr(m->nspills);
+}
+
+/*!
+ * Iterate over all memory segments allocated.
+ * \param m; The allocator
+ * \param cbk; Callback that is given the address of a segment and its size. \see ak_seg_cbk.
+ *
+ * \return \c 0 if \p cbk stopped the iteration, else non-zero.
+ */
+static int ak_malloc_for_each_segment_in_state(ak_malloc_state* m, ak_seg_cbk cbk)
+{
+    // for each slab, reclaim empty pages
+    for (ak_sz i = 0; i < NSLABS; ++i) {
+        ak_slab_root* s = ak_as_ptr(m->slabs[i]);
+        ak_circ_list_for_each(ak_slab, fslab, &(s->full_root)) {
+            if (!cbk(fslab, AKMALLOC_DEFAULT_PAGE_SIZE)) {
+                return 0;
+            }
+        }
+        for (int b = 0; b < AK_SLAB_PARTIAL_BUCKETS; ++b) {
+            ak_circ_list_for_each(ak_slab, pslab, &(s->partial_root[b])) {
+                if (!cbk(pslab, AKMALLOC_DEFAULT_PAGE_SIZE)) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+#if defined(AK_SLAB_SPANS)
+    for (ak_sz i = 0; i < NSPANS; ++i) {
+        ak_slab_root* s = ak_as_ptr(m->spans[i]);
+        ak_circ_list_for_each(ak_slab, fslab, &(s->full_root)) {
+            if (!cbk(fslab, s->spansz)) {
+                return 0;
+            }
+        }
+        for (int b = 0; b < AK_SLAB_PARTIAL_BUCKETS; ++b) {
+            ak_circ_list_for_each(ak_slab, pslab, &(s->partial_root[b])) {
+                if (!cbk(pslab, s->spansz)) {
+                    return 0;
+                }
+            }
+        }
+    }
+#endif
+
+    {// ca roots
+        for (ak_sz i = 0; i < NCAROOTS; ++i) {
+            ak_circ_list_for_each(ak_ca_segment, seg, &(m->ca[i].main_root)) {
+                if (!cbk(seg->head, seg->sz)) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    {// mmaped chunks
+        ak_circ_list_for_each(ak_ca_segment, seg, &(m->map_root)) {
+            if (!cbk(seg, seg->sz)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+/********************** mallocstate end ************************/
+
+/********************** thread cache begin ************************/
+/*!
+ *
+ * \page tcache Thread cache
+ *
+ * Every slab root is guarded by a lock, so threads that allocate the same small sizes
+ * serialize on it. The thread cache sits in front of the slab roots of the global malloc state
+ * and removes the lock from most small allocations and frees.
+ *
+ * Each thread owns one bin per slab size, which is a bounded stack of free objects.
+ *
+ * -# <em>Allocation</em> pops from the bin. An empty bin is refilled with half its capacity
+ *    from the slab root under one acquisition of its lock.
+ *
+ * -# <em>Free</em> pushes onto the bin of the object's size. A full bin returns its older half
+ *    to the slab roots under one acquisition of each lock.
+ *
+ * The cache memory is obtained from the OS when the thread first allocates, and all cached
+ * objects are returned to the slabs when the thread exits. Frees that happen after the cache of a
+ * thread is drained (e.g. from other thread exit handlers) go directly to the slabs.
+ */
+
+#if AKMALLOC_THREAD_CACHE
+
+#if !defined(AK_TCACHE_CAPACITY)
+#  define AK_TCACHE_CAPACITY 64
+#endif
+
+#define AK_TCACHE_BATCH (AK_TCACHE_CAPACITY / 2)
+
+typedef struct ak_tcache_bin_tag ak_tcache_bin;
+
+typedef struct ak_tcache_tag ak_tcache;
+
+struct ak_tcache_bin_tag
+{
+    ak_u32 n;                           /**< number of cached objects */
+    ak_u32 _unused;                     /**< for alignment */
+    void*  objs[AK_TCACHE_CAPACITY];    /**< stack of cached objects, newest at the back */
+};
+
+/*!
+ * Per thread cache of slab objects
+ */
+struct ak_tcache_tag
+{
+    ak_malloc_state* m;                 /**< state that the cache refills from */
+    ak_sz            sz;                /**< bytes obtained from the OS for the cache */
+    ak_tcache_bin    bins[NSLABS];      /**< one bin per slab size */
+};
+
+/* marks a thread whose cache has been drained at thread exit */
+#define AK_TCACHE_DEAD ((ak_tcache*)(void*)AK_SZ_ONE)
+
+static ak_thread_local ak_tcache* AK_TCACHE_PTR = AK_NULLPTR;
+
+static ak_thread_key AK_TCACHE_KEY;
+
+/**************************************************************/
+/* P R I V A T E                                              */
+/**************************************************************/
+
+static void ak_tcache_flush(ak_tcache_bin* bin, ak_u32 n)
+{
+    AKMALLOC_ASSERT(n <= bin->n);
+    // convert the oldest entries to slab pointers and return them
+    for (ak_u32 i = 0; i < n; ++i) {
+        bin->objs[i] = ak_slab_mem_2_alloc(bin->objs[i]);
+    }
+    ak_slab_free_n(bin->objs, n);
+
+    const ak_u32 nleft = bin->n - n;
+    for (ak_u32 i = 0; i < nleft; ++i) {
+        bin->objs[i] = bin->objs[i + n];
+    }
+    bin->n = nleft;
+}
+
+static int ak_tcache_refill(ak_tcache* tc, ak_tcache_bin* bin, ak_sz idx)
+{
+    AKMALLOC_ASSERT(bin->n == 0);
+    ak_u32 n = ak_slab_alloc_n(ak_as_ptr(tc->m->slabs[idx]), bin->objs, AK_TCACHE_BATCH);
+    for (ak_u32 i = 0; i < n; ++i) {
+        ak_sz* mem = (ak_sz*)bin->objs[i];
+        ak_alloc_mark_slab(ak_slab_alloc_2_mem(mem)); // we overallocate
+        bin->objs[i] = ak_slab_alloc_2_mem(mem);
+    }
+    bin->n = n;
+    return n != 0;
+}
+
+static void AK_THREAD_EXIT_CALLBACK ak_tcache_thread_exit(void* p)
+{
+    ak_tcache* tc = (ak_tcache*)p;
+    if (tc) {
+        for (ak_sz i = 0; i < NSLABS; ++i) {
+            ak_tcache_flush(ak_as_ptr(tc->bins[i]), tc->bins[i].n);
+        }
+        AK_TCACHE_PTR = AK_TCACHE_DEAD;
+        ak_os_free(tc, tc->sz);
+    }
+}
+
+static ak_tcache* ak_tcache_create(ak_malloc_state* m)
+{
+    if (AK_TCACHE_PTR == AK_TCACHE_DEAD) {
+        return AK_NULLPTR;
+    }
+
+    const ak_sz sz = (sizeof(ak_tcache) + AKMALLOC_DEFAULT_PAGE_SIZE - 1) & ~((ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1));
+    ak_tcache* tc = (ak_tcache*)ak_os_alloc(sz);
+    if (ak_unlikely(!tc)) {
+        return AK_NULLPTR;
+    }
+    // OS memory is zeroed, so all bins are empty
+    tc->m = m;
+    tc->sz = sz;
+    ak_thread_key_set(AK_TCACHE_KEY, tc);
+    AK_TCACHE_PTR = tc;
+    return tc;
+}
+
+ak_inline static ak_tcache* ak_tcache_get(ak_malloc_state* m)
+{
+    ak_tcache* tc = AK_TCACHE_PTR;
+    return ak_likely(((ak_sz)tc) > ((ak_sz)AK_TCACHE_DEAD)) ? tc : ak_tcache_create(m);
+}
+
+/**************************************************************/
+/* P U B L I C                                                */
+/**************************************************************/
+
+/*!
+ * Initialize the thread cache machinery. Must be called once before any other thread cache call.
+ */
+static void ak_tcache_init_global()
+{
+    AKMALLOC_ASSERT_ALWAYS(ak_thread_key_create(ak_as_ptr(AK_TCACHE_KEY), ak_tcache_thread_exit));
+}
+
+/*!
+ * Attempt to allocate memory from the calling thread's cache.
+ * \param m; The allocator the cache refills from
+ * \param sz; The size for the allocation
+ *
+ * \return \c 0 if \p sz is not a slab size or no memory is available, else pointer to at least
+ * \p sz bytes of memory.
+ */
+ak_inline static void* ak_tcache_alloc(ak_malloc_state* m, size_t sz)
+{
+    const ak_sz modsz = ak_slab_mod_sz(sz);
+    if (modsz > MIN_SMALL_REQUEST) {
+        return AK_NULLPTR;
+    }
+
+    ak_tcache* tc = ak_tcache_get(m);
+    if (ak_unlikely(!tc)) {
+        return AK_NULLPTR;
+    }
+
+    const ak_sz idx = ak_slab_size_to_index(modsz);
+    ak_tcache_bin* bin = ak_as_ptr(tc->bins[idx]);
+    if (ak_unlikely(bin->n == 0) && !ak_tcache_refill(tc, bin, idx)) {
+        return AK_NULLPTR;
+    }
+    void* mem = bin->objs[--(bin->n)];
+    AKMALLOC_ASSERT(ak_alloc_is_slab(mem));
+    return mem;
+}
+
+/*!
+ * Attempt to return slab memory to the calling thread's cache.
+ * \param m; The allocator the cache refills from
+ * \param mem; Pointer to slab memory to return.
+ *
+ * \return \c 0 if the thread has no cache, and non-zero if the memory was taken.
+ */
+ak_inline static int ak_tcache_free(ak_malloc_state* m, void* mem)
+{
+    AKMALLOC_ASSERT(ak_alloc_is_slab(mem));
+
+    ak_tcache* tc = ak_tcache_get(m);
+    if (ak_unlikely(!tc)) {
+        return 0;
+    }
+
+    const ak_slab* slab = ak_slab_of(mem);
+    if (slab->root->sz > MIN_SMALL_REQUEST) {
+        // objects of slabs spanning several pages are not cached
+        return 0;
+    }
+#if AKMALLOC_NUMA
+    // memory of another arena may live on another node, return it to its owner
+    if (((ak_sz)slab->root < (ak_sz)(tc->m->slabs)) || ((ak_sz)slab->root >= (ak_sz)(tc->m->slabs + NSLABS))) {
+        return 0;
+    }
+#endif
+    ak_tcache_bin* bin = ak_as_ptr(tc->bins[ak_slab_size_to_index(slab->root->sz)]);
+    if (ak_unlikely(bin->n == AK_TCACHE_CAPACITY)) {
+        ak_tcache_flush(bin, AK_TCACHE_BATCH);
+    }
+    bin->objs[(bin->n)++] = mem;
+    return 1;
+}
+
+#endif/*AKMALLOC_THREAD_CACHE*/
+/********************** thread cache end ************************/
+
+/********************** cpu cache begin ************************/
+/*!
+ *
+ * \page cpucache Per-CPU magazines
+ *
+ * This is the magazine and depot layer of <a href="https://www.usenix.org/legacy/event/usenix01/full_papers/bonwick/bonwick.pdf">Bonwick and Adams' paper</a>
+ * on extending the slab allocator, placed in front of the slab roots of the global malloc state.
+ * It is an alternative to the \ref tcache for processes with many more threads than CPUs, since
+ * the cached memory is proportional to the number of CPUs rather than the number of threads.
+ *
+ * A magazine is a bounded stack of free objects of one slab size. Every CPU holds two
+ * magazines per slab size, the <em>loaded</em> and the <em>previous</em> one.
+ *
+ * -# <em>Allocation</em> pops from the loaded magazine. If it is empty and the previous one is
+ *    not, the two are swapped. Otherwise a full magazine is taken from the depot, and only if the
+ *    depot has none the loaded magazine is filled from the slab root under one lock acquisition.
+ *
+ * -# <em>Free</em> pushes onto the loaded magazine. If it is full and the previous one is empty,
+ *    the two are swapped. Otherwise the previous magazine is handed to the depot and an empty one
+ *    is loaded. When the depot is full the magazine is emptied back into the slab root instead.
+ *
+ * The depot keeps a list of full magazines for each slab size and a shared list of empty ones.
+ *
+ * The CPU is read from the <tt>rseq</tt> area that the C library registers for every thread, or
+ * from <tt>sched_getcpu()</tt> if there is none. Since a thread may be migrated at any point, each
+ * CPU's magazines are guarded by a lock that is only ever tried. It is uncontended unless a thread
+ * was preempted or migrated while holding it, in which case the request goes to the slab root.
+ */
+
+#if AKMALLOC_CPU_CACHE
+
+#if !AKMALLOC_LINUX
+#  error "AKMALLOC_CPU_CACHE is only supported on Linux."
+#endif
+
+#if !defined(AK_MALLOCSTATE_USE_LOCKS)
+#  error "AKMALLOC_CPU_CACHE requires locks to be enabled."
+#endif
+
+#if defined(__has_include)
+#  if __has_include(<sys/rseq.h>) && (AKMALLOC_CLANG || __GNUC__ >= 11)
+#    include <sys/rseq.h>
+#    define AK_CPUCACHE_USE_RSEQ 1
+#  endif
+#endif
+
+#if !defined(AK_MAGAZINE_SIZE)
+#  define AK_MAGAZINE_SIZE 30
+#endif
+
+#if !defined(AK_DEPOT_MAX_FULL)
+#  define AK_DEPOT_MAX_FULL 32
+#endif
+
+typedef struct ak_magazine_tag ak_magazine;
+
+typedef struct ak_depot_tag ak_depot;
+
+typedef struct ak_cpucache_tag ak_cpucache;
+
+typedef struct ak_cpucache_global_tag ak_cpucache_global;
+
+struct ak_magazine_tag
+{
+    ak_magazine* next;                  /**< link in depot lists */
+    ak_u32       n;                     /**< number of objects held */
+    ak_u32       _unused;               /**< for alignment */
+    void*        objs[AK_MAGAZINE_SIZE];/**< stack of objects, newest at the back */
+};
+
+/*!
+ * Depot of full magazines for one slab size
+ */
+struct ak_depot_tag
+{
+    ak_magazine* full;                  /**< list of full magazines */
+    ak_u32       nfull;                 /**< number of full magazines */
+    ak_spinlock  LOCKED;                /**< lock for the list */
+};
+
+/*!
+ * Magazines of one CPU
+ */
+struct ak_cpucache_tag
+{
+    ak_spinlock  LOCKED;                /**< tried by the thread running on the CPU */
+    ak_magazine* loaded[NSLABS];        /**< loaded magazine per slab size */
+    ak_magazine* previous[NSLABS];      /**< previous magazine per slab size */
+};
+
+struct ak_cpucache_global_tag
+{
+    char*            cpus;              /**< array of ak_cpucache, one cache line aligned entry per CPU */
+    ak_sz            stride;            /**< distance between entries in \p cpus */
+    ak_u32           ncpus;             /**< number of entries in \p cpus */
+    ak_u32           _unused;           /**< for alignment */
+    ak_depot         depots[NSLABS];    /**< depot for each slab size */
+    ak_magazine*     empty;             /**< list of empty magazines */
+    ak_spinlock      EMPTY_LOCK;        /**< lock for \p empty */
+};
+
+static ak_cpucache_global AK_CPUCACHE;
+
+/**************************************************************/
+/* P R I V A T E                                              */
+/**************************************************************/
+
+ak_inline static ak_u32 ak_cpucache_current_cpu()
+{
+#if defined(AK_CPUCACHE_USE_RSEQ)
+    if (__rseq_size) {
+        const struct rseq* rs = (const struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+        const int cpu = (int)(*(const volatile ak_u32*)(&(rs->cpu_id)));
+        if (ak_likely(cpu >= 0)) {
+            return (ak_u32)cpu;
+        }
+    }
+#endif
+#if defined(__USE_GNU)
+    const int cpu = sched_getcpu();
+    return (cpu >= 0) ? (ak_u32)cpu : 0;
+#else
+    return 0;
+#endif
+}
+
+ak_inline static ak_cpucache* ak_cpucache_current()
+{
+    const ak_u32 cpu = ak_cpucache_current_cpu() % AK_CPUCACHE.ncpus;
+    return ak_ptr_cast(ak_cpucache, AK_CPUCACHE.cpus + (cpu * AK_CPUCACHE.stride));
+}
+
+static ak_magazine* ak_magazine_get_empty()
+{
+    ak_magazine* mag = AK_NULLPTR;
+    ak_spinlock_acquire(ak_as_ptr(AK_CPUCACHE.EMPTY_LOCK));
+    if (!AK_CPUCACHE.empty) {
+        // carve a page into magazines
+        char* mem = (char*)ak_os_alloc(AKMALLOC_DEFAULT_PAGE_SIZE);
+        if (ak_likely(mem)) {
+            const ak_sz nmags = AKMALLOC_DEFAULT_PAGE_SIZE / sizeof(ak_magazine);
+            for (ak_sz i = 0; i < nmags; ++i) {
+                ak_magazine* m = ak_ptr_cast(ak_magazine, mem + (i * sizeof(ak_magazine)));
+                m->next = AK_CPUCACHE.empty;
+                AK_CPUCACHE.empty = m;
+            }
+        }
+    }
+    mag = AK_CPUCACHE.empty;
+    if (ak_likely(mag)) {
+        AK_CPUCACHE.empty = mag->next;
+        mag->next = AK_NULLPTR;
+        mag->n = 0;
+    }
+    ak_spinlock_release(ak_as_ptr(AK_CPUCACHE.EMPTY_LOCK));
+    return mag;
+}
+
+static void ak_magazine_put_empty(ak_magazine* mag)
+{
+    AKMALLOC_ASSERT(mag->n == 0);
+    ak_spinlock_acquire(ak_as_ptr(AK_CPUCACHE.EMPTY_LOCK));
+    mag->next = AK_CPUCACHE.empty;
+    AK_CPUCACHE.empty = mag;
+    ak_spinlock_release(ak_as_ptr(AK_CPUCACHE.EMPTY_LOCK));
+}
+
+static ak_magazine* ak_depot_pop_full(ak_depot* d)
+{
+    ak_magazine* mag = AK_NULLPTR;
+    if (d->full) {
+        ak_spinlock_acquire(ak_as_ptr(d->LOCKED));
+        mag = d->full;
+        if (mag) {
+            d->full = mag->next;
+            --(d->nfull);
+            mag->next = AK_NULLPTR;
+        }
+        ak_spinlock_release(ak_as_ptr(d->LOCKED));
+    }
+    return mag;
+}
+
+static int ak_depot_push_full(ak_depot* d, ak_magazine* mag)
+{
+    int pushed = 0;
+    ak_spinlock_acquire(ak_as_ptr(d->LOCKED));
+    if (d->nfull < AK_DEPOT_MAX_FULL) {
+        mag->next = d->full;
+        d->full = mag;
+        ++(d->nfull);
+        pushed = 1;
+    }
+    ak_spinlock_release(ak_as_ptr(d->LOCKED));
+    return pushed;
+}
+
+static int ak_magazine_fill(ak_malloc_state* m, ak_magazine* mag, ak_sz idx)
+{
+    AKMALLOC_ASSERT(mag->n == 0);
+    ak_u32 n = ak_slab_alloc_n(ak_as_ptr(m->slabs[idx]), mag->objs, AK_MAGAZINE_SIZE);
+    for (ak_u32 i = 0; i < n; ++i) {
+        ak_sz* mem = (ak_sz*)mag->objs[i];
+        ak_alloc_mark_slab(ak_slab_alloc_2_mem(mem)); // we overallocate
+        mag->objs[i] = ak_slab_alloc_2_mem(mem);
+    }
+    mag->n = n;
+    return n != 0;
+}
+
+static void ak_magazine_empty_to_slabs(ak_magazine* mag)
+{
+    for (ak_u32 i = 0; i < mag->n; ++i) {
+        mag->objs[i] = ak_slab_mem_2_alloc(mag->objs[i]);
+    }
+    ak_slab_free_n(mag->objs, mag->n);
+    mag->n = 0;
+}
+
+static void* ak_cpucache_alloc_slow(ak_malloc_state* m, ak_cpucache* c, ak_sz idx)
+{
+    ak_magazine* loaded = c->loaded[idx];
+    ak_magazine* prev = c->previous[idx];
+    ak_magazine* full = AK_NULLPTR;
+
+    if (prev && prev->n) {
+        // swap loaded and previous
+        full = prev;
+        prev = loaded;
+    } else if ((full = ak_depot_pop_full(ak_as_ptr(AK_CPUCACHE.depots[idx])))) {
+        // previous is empty, loaded becomes previous
+        if (prev) {
+            ak_magazine_put_empty(prev);
+        }
+        prev = loaded;
+    } else {
+        // fill loaded from the slab
+        full = loaded ? loaded : ak_magazine_get_empty();
+        if (ak_unlikely(!full)) {
+            return AK_NULLPTR;
+        }
+        c->loaded[idx] = full;
+        if (ak_unlikely(!ak_magazine_fill(m, full, idx))) {
+            return AK_NULLPTR;
+        }
+    }
+
+    c->previous[idx] = prev;
+    c->loaded[idx] = full;
+    return full->objs[--(full->n)];
+}
+
+static int ak_cpucache_free_slow(ak_cpucache* c, ak_sz idx, void* mem)
+{
+    ak_magazine* prev = c->previous[idx];
+    ak_magazine* empty = AK_NULLPTR;
+
+    if (prev && prev->n == 0) {
+        // swap loaded and previous
+        empty = prev;
+    } else {
+        // hand the full previous to the depot, or to the slabs if the depot is full
+        if (prev) {
+            if (!ak_depot_push_full(ak_as_ptr(AK_CPUCACHE.depots[idx]), prev)) {
+                ak_magazine_empty_to_slabs(prev);
+                empty = prev;
+            }
+            c->previous[idx] = AK_NULLPTR;
+        }
+        if (!empty) {
+            empty = ak_magazine_get_empty();
+            if (ak_unlikely(!empty)) {
+                return 0;
+            }
+        }
+    }
+
+    c->previous[idx] = c->loaded[idx];
+    c->loaded[idx] = empty;
+    empty->objs[(empty->n)++] = mem;
+    return 1;
+}
+
+/**************************************************************/
+/* P U B L I C                                                */
+/**************************************************************/
+
+/*!
+ * Initialize the per-CPU magazines. Must be called once before any other per-CPU magazine call.
+ */
+static void ak_cpucache_init_global()
+{
+    for (ak_sz i = 0; i < NSLABS; ++i) {
+        AK_CPUCACHE.depots[i].full = AK_NULLPTR;
+        AK_CPUCACHE.depots[i].nfull = 0;
+        ak_spinlock_init(ak_as_ptr(AK_CPUCACHE.depots[i].LOCKED));
+    }
+    AK_CPUCACHE.empty = AK_NULLPTR;
+    ak_spinlock_init(ak_as_ptr(AK_CPUCACHE.EMPTY_LOCK));
+
+    const ak_u32 ncpus = ak_os_num_cpus();
+    const ak_sz stride = (sizeof(ak_cpucache) + AKMALLOC_CACHE_LINE_LENGTH - 1) & ~((ak_sz)(AKMALLOC_CACHE_LINE_LENGTH - 1));
+    const ak_sz sz = ((ncpus * stride) + AKMALLOC_DEFAULT_PAGE_SIZE - 1) & ~((ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1));
+    // OS memory is zeroed, so all locks are free and no magazines are loaded
+    AK_CPUCACHE.cpus = (char*)ak_os_alloc(sz);
+    AK_CPUCACHE.stride = stride;
+    AK_CPUCACHE.ncpus = AK_CPUCACHE.cpus ? ncpus : 0;
+}
+
+/*!
+ * Attempt to allocate memory from the magazines of the current CPU.
+ * \param m; The allocator magazines are filled from if the depot is empty
+ * \param sz; The size for the allocation
+ *
+ * \return \c 0 if \p sz is not a slab size, the CPU's magazines are busy or no memory is
+ * available, else pointer to at least \p sz bytes of memory.
+ */
+ak_inline static void* ak_cpucache_alloc(ak_malloc_state* m, size_t sz)
+{
+    const ak_sz modsz = ak_slab_mod_sz(sz);
+    if (modsz > MIN_SMALL_REQUEST || ak_unlikely(!AK_CPUCACHE.ncpus)) {
+        return AK_NULLPTR;
+    }
+
+    const ak_sz idx = ak_slab_size_to_index(modsz);
+    ak_cpucache* c = ak_cpucache_current();
+    if (ak_unlikely(!ak_spinlock_try_acquire(ak_as_ptr(c->LOCKED)))) {
+        return AK_NULLPTR;
+    }
+    void* mem = AK_NULLPTR;
+    ak_magazine* mag = c->loaded[idx];
+    if (ak_likely(mag && mag->n)) {
+        mem = mag->objs[--(mag->n)];
+    } else {
+        mem = ak_cpucache_alloc_slow(m, c, idx);
+    }
+    ak_spinlock_release(ak_as_ptr(c->LOCKED));
+    AKMALLOC_ASSERT(!mem || ak_alloc_is_slab(mem));
+    return mem;
+}
+
+/*!
+ * Attempt to return slab memory to the magazines of the current CPU.
+ * \param m; The allocator of the calling thread
+ * \param mem; Pointer to slab memory to return.
+ *
+ * \return \c 0 if the CPU's magazines are busy, and non-zero if the memory was taken.
+ */
+ak_inline static int ak_cpucache_free(ak_malloc_state* m, void* mem)
+{
+    AKMALLOC_ASSERT(ak_alloc_is_slab(mem));
+#if !AKMALLOC_NUMA
+    (void)m;
+#endif
+    if (ak_unlikely(!AK_CPUCACHE.ncpus)) {
+        return 0;
+    }
+
+    const ak_slab* slab = ak_slab_of(mem);
+    if (slab->root->sz > MIN_SMALL_REQUEST) {
+        // objects of slabs spanning several pages are not cached
+        return 0;
+    }
+#if AKMALLOC_NUMA
+    // memory of another arena may live on another node, return it to its owner
+    if (((ak_sz)slab->root < (ak_sz)(m->slabs)) || ((ak_sz)slab->root >= (ak_sz)(m->slabs + NSLABS))) {
+        return 0;
+    }
+#endif
+    const ak_sz idx = ak_slab_size_to_index(slab->root->sz);
+    ak_cpucache* c = ak_cpucache_current();
+    if (ak_unlikely(!ak_spinlock_try_acquire(ak_as_ptr(c->LOCKED)))) {
+        return 0;
+    }
+    int freed = 1;
+    ak_magazine* mag = c->loaded[idx];
+    if (ak_likely(mag && mag->n < AK_MAGAZINE_SIZE)) {
+        mag->objs[(mag->n)++] = mem;
+    } else {
+        freed = ak_cpucache_free_slow(c, idx, mem);
+    }
+    ak_spinlock_release(ak_as_ptr(c->LOCKED));
+    return freed;
+}
+
+#endif/*AKMALLOC_CPU_CACHE*/
+/********************** cpu cache end ************************/
+
+
+/***********************************************
+ * Exported APIs
+ ***********************************************/
+
+static int MALLOC_INIT = 0;
+
+static ak_malloc_state MALLOC_ROOT;
+static ak_malloc_state* GMSTATE = AK_NULLPTR;
+static ak_lock MALLOC_INIT_LOCK;
+#if defined(AK_MALLOCSTATE_USE_LOCKS)
+static ak_u32 MALLOC_DEFER_RELEASE = 0;
+#endif
+
+/********************** arenas begin ************************/
+/*!
+ * \page arenas Arenas
+ *
+ * All threads share the global malloc state unless arenas are enabled with
+ * <tt>AKMALLOC_ARENAS</tt>. Then up to <tt>AKMALLOC_NUM_ARENAS</tt> independent malloc states
+ * are created on demand, and every thread is bound to one of them the first time it allocates.
+ * A new thread is bound to the arena with the fewest threads, which hands out arenas round robin
+ * until all of them exist. Arenas are never destroyed.
+ *
+ * Memory is always returned to the arena that owns it, no matter which thread frees it. Slabs
+ * know their root, and coalesced and mmap-ed memory is found through the page map.
+ *
+ * With <tt>AKMALLOC_NUMA</tt> the arenas are split evenly between the NUMA nodes, and a thread
+ * only picks among the arenas of its node (see \ref numa).
+ */
+#if AKMALLOC_ARENAS
+
+#if !defined(AK_ARENAS_PER_CPU)
+#  define AK_ARENAS_PER_CPU 2
+#endif
+
+#if !defined(AKMALLOC_NUM_ARENAS)
+#  define AKMALLOC_NUM_ARENAS 0
+#endif
+
+#if !defined(AK_MAX_ARENAS)
+#  define AK_MAX_ARENAS 64
+#endif
+
+static ak_malloc_state* ARENAS[AK_MAX_ARENAS];
+static ak_u32 ARENA_NTHREADS[AK_MAX_ARENAS];
+static ak_u32 NARENAS = 1;
+static ak_spinlock ARENA_LOCK = { 0 };
+static ak_thread_key ARENA_KEY;
+
+static ak_thread_local ak_malloc_state* AK_ARENA = AK_NULLPTR;
+
+static void AK_THREAD_EXIT_CALLBACK ak_arena_thread_exit(void* p)
+{
+    const ak_sz idx = ((ak_sz)p) - 1;
+    ak_spinlock_acquire(ak_as_ptr(ARENA_LOCK));
+    --(ARENA_NTHREADS[idx]);
+    ak_spinlock_release(ak_as_ptr(ARENA_LOCK));
+}
+
+static void ak_arena_init_global(ak_malloc_state* m)
+{
+    ak_u32 n = (AKMALLOC_NUM_ARENAS > 0) ? (ak_u32)(AKMALLOC_NUM_ARENAS) : (ak_u32)(AK_ARENAS_PER_CPU * ak_os_num_cpus());
+    NARENAS = (n > AK_MAX_ARENAS) ? AK_MAX_ARENAS : ((n > 0) ? n : 1);
+#if AKMALLOC_NUMA
+    ak_numa_init_global();
+    // arena i belongs to node (i % NUMA_NODES), every node gets the same number of arenas
+    if (NUMA_NODES > AK_MAX_ARENAS) {
+        NUMA_NODES = AK_MAX_ARENAS;
+    }
+    NARENAS = ((NARENAS + NUMA_NODES - 1) / NUMA_NODES) * NUMA_NODES;
+    if (NARENAS > AK_MAX_ARENAS) {
+        NARENAS = (AK_MAX_ARENAS / NUMA_NODES) * NUMA_NODES;
+    }
+#endif
+    ARENAS[0] = m;
+    AKMALLOC_ASSERT_ALWAYS(ak_thread_key_create(ak_as_ptr(ARENA_KEY), ak_arena_thread_exit));
+}
+
+static ak_malloc_state* ak_arena_assign()
+{
+#if AKMALLOC_NUMA
+    const ak_u32 first = ak_numa_current_node();
+    const ak_u32 stride = NUMA_NODES;
+    // place the arena and everything the thread maps on its node
+    ak_numa_set_node(first);
+#else
+    const ak_u32 first = 0;
+    const ak_u32 stride = 1;
+#endif
+    ak_spinlock_acquire(ak_as_ptr(ARENA_LOCK));
+    // least loaded arena, ties go to the lowest index
+    ak_u32 best = first;
+    for (ak_u32 i = first + stride; i < NARENAS; i += stride) {
+        if (ARENA_NTHREADS[i] < ARENA_NTHREADS[best]) {
+            best = i;
+        }
+    }
+    if (!ARENAS[best]) {
+        const ak_sz sz = (sizeof(ak_malloc_state) + AKMALLOC_DEFAULT_PAGE_SIZE - 1) & ~((ak_sz)(AKMALLOC_DEFAULT_PAGE_SIZE - 1));
+        ak_malloc_state* m = (ak_malloc_state*)ak_os_alloc(sz);
+        if (ak_likely(m)) {
+            ak_malloc_init_state(m);
+            ak_malloc_state_defer_release(m, *(volatile ak_u32*)ak_as_ptr(MALLOC_DEFER_RELEASE));
+            ARENAS[best] = m;
+        } else {
+            best = 0;
+        }
+    }
+    ++(ARENA_NTHREADS[best]);
+    ak_spinlock_release(ak_as_ptr(ARENA_LOCK));
+
+    ak_thread_key_set(ARENA_KEY, (void*)(((ak_sz)best) + 1));
+    AK_ARENA = ARENAS[best];
+    return AK_ARENA;
+}
+
+#  define ak_malloc_init_arenas() ak_arena_init_global(GMSTATE)
+#  define ak_malloc_thread_state() (ak_likely(AK_ARENA) ? AK_ARENA : ak_arena_assign())
+#else
+#  define ak_malloc_init_arenas()
+#  define ak_malloc_thread_state() GMSTATE
+#endif/*AKMALLOC_ARENAS*/
+/********************** arenas end ************************/
+
+/********************** async free begin ************************/
+/*!
+ * \page asyncfree Asynchronous free
+ *
+ * <tt>ak_free_async()</tt> pushes the pointer on a global lock-free queue, linked through the
+ * first word of the freed memory, and returns. Threads that call
+ * <tt>ak_malloc_set_async_free(1)</tt> do the same from <tt>ak_free()</tt>. The queue is emptied in
+ * batches by the maintenance thread on every wake up, or by whichever thread calls
+ * <tt>ak_malloc_drain_async_frees()</tt>. The number of queued frees is reported in
+ * <tt>ak_malloc_stats::async_free_backlog</tt>.
+ */
+#if AKMALLOC_ASYNC_FREE
+
+static void* volatile AK_ASYNC_FREE_HEAD = AK_NULLPTR;
+static ak_u32 AK_ASYNC_FREE_BACKLOG = 0;
+static ak_thread_local ak_u32 AK_ASYNC_FREE_MODE = 0;
+
+/*!
+ * Queue memory to be freed by another thread.
+ * \param mem; The memory to free, must not be \c 0
+ */
+ak_inline static void ak_async_free_push(void* mem)
+{
+    // counted before it can be drained, so that the drain never takes the backlog below zero
+    ak_atomic_fetch_add(ak_as_ptr(AK_ASYNC_FREE_BACKLOG), 1);
+    void* head;
+    do {
+        head = AK_ASYNC_FREE_HEAD;
+        *(void**)mem = head;
+    } while (!ak_atomic_cas_ptr(&AK_ASYNC_FREE_HEAD, mem, head));
+}
+
+/*!
+ * Free all queued memory. The whole queue is taken at once and every pointer is freed without
+ * waiting for allocator locks, a busy allocator queues it for its lock holder instead.
+ */
+static void ak_async_free_drain()
+{
+    if (!AK_ASYNC_FREE_HEAD) {
+        return;
+    }
+    void* p = ak_atomic_xchg_ptr(&AK_ASYNC_FREE_HEAD, AK_NULLPTR);
+    ak_u32 n = 0;
+    while (p) {
+        void* next = *(void**)p;
+        ak_free_to_state(GMSTATE, p);
+        p = next;
+        ++n;
+    }
+    ak_atomic_fetch_add(ak_as_ptr(AK_ASYNC_FREE_BACKLOG), (ak_u32)0 - n);
+}
+
+#  define ak_async_free_backlog() (*(volatile ak_u32*)ak_as_ptr(AK_ASYNC_FREE_BACKLOG))
+#else
+#  define ak_async_free_drain()
+#  define ak_async_free_backlog() 0
+#endif/*AKMALLOC_ASYNC_FREE*/
+/********************** async free end ************************/
+
+/********************** epochs begin ************************/
+/*!
+ * \page epochs Epoch based reclamation
+ *
+ * Lock-free data structures cannot free a node as soon as it is unlinked, because other threads
+ * may still be reading it. Readers bracket their accesses with <tt>ak_epoch_enter()</tt> and
+ * <tt>ak_epoch_exit()</tt>, and writers hand unlinked nodes to <tt>ak_free_deferred()</tt>.
+ *
+ * A global epoch counter advances by one when every thread inside a critical section has
+ * observed its current value. An object retired while the counter read \c e cannot be reached by
+ * any reader once the counter reads <tt>e + 2</tt>. Every thread keeps the objects it retired in
+ * bags of \c AK_EPOCH_BAG_SIZE pointers tagged with the epoch of their newest object. A full bag
+ * triggers an attempt to advance the epoch, and every bag that has become safe is freed at once.
+ * Its pointers are sorted by address first, so that the objects of a slab page or coalescing
+ * root are returned under one acquisition of its lock.
+ *
+ * Retired objects are never written to. The per thread records are carved from OS pages and are
+ * never returned to the OS. A thread that exits leaves its record and the bags that were not yet
+ * safe to the next thread that needs a record.
+ */
+#if !defined(AK_EPOCH_BAG_SIZE)
+#  define AK_EPOCH_BAG_SIZE 62
+#endif
+
+typedef struct ak_epoch_bag_tag ak_epoch_bag;
+
+typedef struct ak_epoch_rec_tag ak_epoch_rec;
+
+struct ak_epoch_bag_tag
+{
+    ak_epoch_bag* next;                 /**< next older bag */
+    ak_u32        n;                    /**< number of retired objects */
+    ak_u32        epoch;                /**< epoch at which the newest object was retired */
+    void*         objs[AK_EPOCH_BAG_SIZE];
+};
+
+/*!
+ * Per thread epoch record, on its own cache line(s)
+ */
+struct ak_epoch_rec_tag
+{
+    AK_CACHE_ALIGNED
+    ak_u32        state;                /**< epoch observed on entry shifted left by one, or-ed with
+                                             1 while inside a critical section */
+    ak_u32        inuse;                /**< whether a thread owns the record */
+    ak_u32        nest;                 /**< critical section nesting depth */
+    ak_u32        _unused;              /**< for alignment */
+    ak_epoch_bag* bags;                 /**< retired objects, newest bag first */
+    ak_epoch_bag* spare;                /**< an empty bag kept for reuse */
+    ak_epoch_rec* next;                 /**< next record in the registry, never changes */
+};
+
+#define AK_EPOCH_MASK 0x7FFFFFFF
+
+static ak_u32 AK_EPOCH_GLOBAL = 0;
+static ak_epoch_rec* volatile AK_EPOCH_RECS = AK_NULLPTR;
+static ak_thread_local ak_epoch_rec* AK_EPOCH_REC = AK_NULLPTR;
+static ak_thread_key AK_EPOCH_KEY;
+
+/**************************************************************/
+/* P R I V A T E                                              */
+/**************************************************************/
+
+#define ak_epoch_now() (*(volatile ak_u32*)ak_as_ptr(AK_EPOCH_GLOBAL))
+
+#define ak_epoch_is_safe(e, now) ((((now) - (e)) & AK_EPOCH_MASK) >= 2)
+
+/*!
+ * Advance the global epoch if every thread inside a critical section has observed it.
+ */
+static void ak_epoch_try_advance()
+{
+    ak_atomic_fence();
+    const ak_u32 g = ak_epoch_now();
+    for (ak_epoch_rec* r = AK_EPOCH_RECS; r; r = r->next) {
+        const ak_u32 st = *(volatile ak_u32*)ak_as_ptr(r->state);
+        if ((st & 1) && ((st >> 1) != g)) {
+            return;
+        }
+    }
+    ak_atomic_cas(ak_as_ptr(AK_EPOCH_GLOBAL), (g + 1) & AK_EPOCH_MASK, g);
+}
+
+/*!
+ * Free the objects of a bag, sorted by address so that neighbours share lock acquisitions.
+ * \param b; The bag
+ */
+static void ak_epoch_free_bag(ak_epoch_bag* b)
+{
+    void** objs = b->objs;
+    for (ak_u32 i = 1; i < b->n; ++i) {
+        void* v = objs[i];
+        ak_u32 j = i;
+        for (; (j > 0) && ((ak_sz)objs[j - 1] > (ak_sz)v); --j) {
+            objs[j] = objs[j - 1];
+        }
+        objs[j] = v;
+    }
+    ak_free_batch_to_state(GMSTATE, objs, b->n);
+    b->n = 0;
+}
+
+/*!
+ * Free every bag of the record that no reader can reach anymore.
+ * \param r; The record of the calling thread
  */
-ak_inline static void* ak_realloc_in_place_from_state(ak_malloc_state* m, void* mem, size_t newsz)
+static void ak_epoch_reclaim(ak_epoch_rec* r)
 {
-    const ak_sz usablesize = ak_malloc_usable_size_in_state(mem);
-    if (usablesize >= newsz) {
-        return mem;
+    const ak_u32 g = ak_epoch_now();
+    // bags are ordered newest first, everything after the first safe bag is safe too
+    ak_epoch_bag** pb = ak_as_ptr(r->bags);
+    while (*pb && !ak_epoch_is_safe((*pb)->epoch, g)) {
+        pb = ak_as_ptr((*pb)->next);
     }
-    if (ak_alloc_type_coalesce(ak_alloc_type_bits(mem))) {
-        ak_alloc_node* n = ak_ptr_cast(ak_alloc_node, mem) - 1;
-        AKMALLOC_ASSERT(ak_ca_is_free(n->currinfo));
-        // check if there is a free next, if so, maybe merge
-        ak_sz sz = ak_ca_to_sz(n->currinfo);
-        ak_ca_root* proot = ak_find_ca_root(m, sz);
-        if (ak_ca_realloc_in_place(proot, mem, newsz)) {
-            return mem;
+    ak_epoch_bag* b = *pb;
+    *pb = AK_NULLPTR;
+    while (b) {
+        ak_epoch_bag* next = b->next;
+        ak_epoch_free_bag(b);
+        if (!r->spare) {
+            r->spare = b;
+        } else {
+            ak_free_to_state(GMSTATE, b);
         }
+        b = next;
     }
-    return AK_NULLPTR;
 }
 
 /*!
- * Attempt to grow memory at the region pointed to by \p p to a size \p newsz.
- * \param m; The allocator
- * \param mem; Memory to grow
- * \param newsz; New size to grow to
- *
- * This function will copy the old bytes to a new memory location if the old memory cannot be
- * grown in place, and will free the old memory. If no more memory is available it will not
- * destroy the old memory.
+ * Claim a free record, or add a page of new records to the registry.
  *
- * \return \c NULL if no memory is available, or a pointer to memory with at least \p newsz bytes.
+ * \return \c 0 if the OS is out of memory, else the record.
  */
-static void* ak_realloc_from_state(ak_malloc_state* m, void* mem, size_t newsz)
+static ak_epoch_rec* ak_epoch_claim_rec()
 {
-    if (ak_unlikely(!mem)) {
-        return ak_malloc_from_state(m, newsz);
+    for (ak_epoch_rec* r = AK_EPOCH_RECS; r; r = r->next) {
+        if (!*(volatile ak_u32*)ak_as_ptr(r->inuse) && ak_atomic_cas(ak_as_ptr(r->inuse), 1, 0)) {
+            return r;
+        }
     }
-
-    if (ak_realloc_in_place_from_state(m, mem, newsz)) {
-        return mem;
+    ak_epoch_rec* recs = (ak_epoch_rec*)ak_os_alloc(AKMALLOC_DEFAULT_PAGE_SIZE);
+    if (ak_unlikely(!recs)) {
+        return AK_NULLPTR;
+    }
+    // OS memory is zeroed, so all records are outside critical sections and empty
+    const ak_sz nrecs = AKMALLOC_DEFAULT_PAGE_SIZE / sizeof(ak_epoch_rec);
+    for (ak_sz i = 0; i + 1 < nrecs; ++i) {
+        recs[i].next = ak_as_ptr(recs[i + 1]);
     }
+    recs[0].inuse = 1;
+    ak_epoch_rec* head;
+    do {
+        head = AK_EPOCH_RECS;
+        recs[nrecs - 1].next = head;
+    } while (!ak_atomic_cas_ptr(&AK_EPOCH_RECS, recs, head));
+    return recs;
+}
 
-    void* newmem = ak_malloc_from_state(m, newsz);
-    if (!newmem) {
-        return AK_NULLPTR;
+static void AK_THREAD_EXIT_CALLBACK ak_epoch_thread_exit(void* p)
+{
+    ak_epoch_rec* r = (ak_epoch_rec*)p;
+    if (r) {
+        r->nest = 0;
+        ak_atomic_store_release(ak_as_ptr(r->state), 0);
+        ak_epoch_try_advance();
+        ak_epoch_reclaim(r);
+        AK_EPOCH_REC = AK_NULLPTR;
+        // bags that are not safe yet stay with the record for its next owner
+        ak_atomic_store_release(ak_as_ptr(r->inuse), 0);
     }
-    if (ak_likely(mem)) {
-        ak_memcpy(newmem, mem, ak_malloc_usable_size_in_state(mem));
-        ak_free_to_state(m, mem);
+}
+
+ak_inline static ak_epoch_rec* ak_epoch_get_rec()
+{
+    ak_epoch_rec* r = AK_EPOCH_REC;
+    if (ak_unlikely(!r)) {
+        r = ak_epoch_claim_rec();
+        if (ak_likely(r)) {
+            ak_thread_key_set(AK_EPOCH_KEY, r);
+            AK_EPOCH_REC = r;
+        }
     }
-    return newmem;
+    return r;
 }
 
+/**************************************************************/
+/* P U B L I C                                                */
+/**************************************************************/
 
 /*!
- * Return the usable size of the memory region pointed to by \p p.
- * \param mem; Pointer to the memory to determize size of.
- *
- * \return The number of bytes that can be written to in the region.
+ * Initialize the epoch machinery. Must be called once before any other epoch call.
  */
-ak_inline static size_t ak_malloc_usable_size_in_state(const void* mem)
+static void ak_epoch_init_global()
 {
-    if (ak_likely(mem)) {
-        ak_sz ty = ak_alloc_type_bits(mem);
-        if (ak_alloc_type_slab(ty)) {
-            // round to page
-            const ak_slab* slab = (const ak_slab*)(ak_page_start_before_const(mem));
-            return ak_slab_usable_size(slab->root->sz);
-        } else if (ak_alloc_type_mmap(ty)) {
-            return (((const ak_ca_segment*)mem) - 1)->sz - sizeof(ak_ca_segment);
-        } else {
-            AKMALLOC_ASSERT(ak_alloc_type_coalesce(ty));
-            const ak_alloc_node* n = ((const ak_alloc_node*)mem) - 1;
-            AKMALLOC_ASSERT(!ak_ca_is_free(n->currinfo));
-            return ak_ca_to_sz(n->currinfo);
-        }
-    } else {
-        return 0;
-    }
+    AKMALLOC_ASSERT_ALWAYS(ak_thread_key_create(ak_as_ptr(AK_EPOCH_KEY), ak_epoch_thread_exit));
 }
 
 /*!
- * Attempt to allocate memory containing at least \p n bytes at an address which is
- * a multiple of \p aln. \p aln must be a power of two. \p sz must be a multiple of \p aln.
- * \param m; The allocator
- * \param aln; The alignment
- * \param sz; The size for the allocation
+ * Enter a critical section in which retired objects stay valid. Sections may be nested.
  *
- * \return \c 0 on failure, else pointer to at least \p n bytes of memory at an aligned address.
+ * \return \c 0 if no record could be obtained, else non-zero.
  */
-static void* ak_aligned_alloc_from_state(ak_malloc_state* m, size_t aln, size_t sz)
+static int ak_epoch_enter_critical()
 {
-    if (aln <= AK_COALESCE_ALIGN) {
-        return ak_malloc_from_state(m, sz);
+    ak_epoch_rec* r = ak_epoch_get_rec();
+    if (ak_unlikely(!r)) {
+        return 0;
     }
-    if ((aln & AK_SZ_ONE) || (aln & (aln - 1))) {
-        size_t a = AK_COALESCE_ALIGN << 1;
-        while (a < aln)  {
-            a  = (a << 1);
-        }
-        aln = a;
+    if (r->nest++ == 0) {
+        *(volatile ak_u32*)ak_as_ptr(r->state) = (ak_epoch_now() << 1) | 1;
+        // the state must be visible before any shared pointer is read
+        ak_atomic_fence();
     }
-    return ak_aligned_alloc_from_state_no_checks(m, aln, sz);
+    return 1;
 }
 
-#define AK_EINVAL 22
-#define AK_ENOMEM 12
-
 /*!
- * Attempt to allocate memory containing at least \p n bytes at an address which is
- * a multiple of \p aln and assign the address to \p *pmem. \p aln must be a power of two and
- * a multiple of \c sizeof(void*).
- * \param m; The allocator
- * \param pmem; The address where the memory address should be writted.
- * \param aln; The alignment
- * \param sz; The size for the allocation
- *
- * \return \c 0 on success, 12 if no more memory is available, and 22 if \p aln was not a power
- * of two and a multiple of \c sizeof(void*)
+ * Leave a critical section entered with \c ak_epoch_enter_critical().
  */
-static int ak_posix_memalign_from_state(ak_malloc_state* m, void** pmem, size_t aln, size_t sz)
+static void ak_epoch_exit_critical()
 {
-    void* mem = AK_NULLPTR;
-    if (aln == AK_COALESCE_ALIGN) {
-        mem = ak_malloc_from_state(m, sz);
-    } else {
-        ak_sz div = (aln / sizeof(ak_sz));
-        ak_sz rem = (aln & (sizeof(ak_sz)));
-        if (rem != 0 || div == 0 || (div & (div - AK_SZ_ONE)) != 0) {
-            return AK_EINVAL;
-        }
-        aln = (aln <= AK_COALESCE_ALIGN) ? AK_COALESCE_ALIGN : aln;
-        mem = ak_aligned_alloc_from_state_no_checks(m, aln, sz);
-    }
-
-    if (!mem) {
-        return AK_ENOMEM;
+    ak_epoch_rec* r = AK_EPOCH_REC;
+    AKMALLOC_ASSERT(r && r->nest > 0);
+    if (--(r->nest) == 0) {
+        ak_atomic_store_release(ak_as_ptr(r->state), 0);
     }
-
-    *pmem = mem;
-    return 0;
 }
 
 /*!
- * Iterate over all memory segments allocated.
- * \param m; The allocator
- * \param cbk; Callback that is given the address of a segment and its size. \see ak_seg_cbk.
+ * Free memory once no thread can be inside a critical section that started before this call.
+ * If no record or bag can be obtained from the OS, the memory is leaked since freeing it right
+ * away is not safe.
+ * \param mem; The memory to retire, it must not be reachable by new readers anymore
  */
-static void ak_malloc_for_each_segment_in_state(ak_malloc_state* m, ak_seg_cbk cbk)
+static void ak_epoch_retire(void* mem)
 {
-    // for each slab, reclaim empty pages
-    for (ak_sz i = 0; i < NSLABS; ++i) {
-        ak_slab_root* s = ak_as_ptr(m->slabs[i]);
-        ak_circ_list_for_each(ak_slab, fslab, &(s->full_root)) {
-            if (!cbk(fslab, AKMALLOC_DEFAULT_PAGE_SIZE)) {
-                return;
-            }
-        }
-        ak_circ_list_for_each(ak_slab, pslab, &(s->partial_root)) {
-            if (!cbk(pslab, AKMALLOC_DEFAULT_PAGE_SIZE)) {
+    ak_epoch_rec* r = ak_epoch_get_rec();
+    if (ak_unlikely(!r)) {
+        return;
+    }
+    ak_epoch_bag* b = r->bags;
+    if (ak_unlikely(!b || (b->n == AK_EPOCH_BAG_SIZE))) {
+        ak_epoch_try_advance();
+        ak_epoch_reclaim(r);
+        b = r->spare;
+        if (b) {
+            r->spare = AK_NULLPTR;
+        } else {
+            b = (ak_epoch_bag*)ak_malloc_from_state(GMSTATE, sizeof(ak_epoch_bag));
+            if (ak_unlikely(!b)) {
                 return;
             }
+            b->n = 0;
         }
+        b->next = r->bags;
+        r->bags = b;
     }
+    b->objs[(b->n)++] = mem;
+    // the caller's unlink must be visible before the epoch is read, or a reader that enters
+    // after this load could still find the object while the bag carries the older epoch
+    ak_atomic_fence();
+    b->epoch = ak_epoch_now();
+}
+/********************** epochs end ************************/
 
-    {// ca roots
-        for (ak_sz i = 0; i < NCAROOTS; ++i) {
-            ak_circ_list_for_each(ak_ca_segment, seg, &(m->ca[i].main_root)) {
-                if (!cbk(seg->head, seg->sz)) {
-                    return;
-                }
-            }
+/********************** maintenance begin ************************/
+/*!
+ * \page maintenance Maintenance thread
+ *
+ * By default, the free that pushes an allocator over its release rate returns memory to the OS
+ * itself, right after releasing the allocator lock. <tt>ak_malloc_start_maintenance()</tt> starts
+ * a thread that takes over this work: frees then only count empty pages and segments, and the
+ * thread wakes up periodically, detaches whatever is due under the lock and returns it to the OS
+ * after releasing the lock. <tt>ak_malloc_stop_maintenance()</tt> stops the thread and goes back to
+ * releasing memory inline. The thread also performs the frees queued by <tt>ak_free_async()</tt>
+ * every time it wakes up.
+ */
+#if defined(AK_MALLOCSTATE_USE_LOCKS)
+
+typedef struct ak_maintenance_tag ak_maintenance;
+
+struct ak_maintenance_tag
+{
+    ak_thread  thread;                  /**< the maintenance thread */
+    ak_u32     running;                 /**< whether the thread was started */
+    ak_u32     generation;              /**< bumped by every start and stop, a thread runs while
+                                             it matches the value it was started with */
+    ak_u32     interval;                /**< time between passes in milliseconds */
+    ak_u32     _unused;                 /**< for alignment */
+    ak_spinlock LOCKED;                 /**< serializes start and stop */
+};
+
+static ak_maintenance AK_MAINTENANCE;
+
+static void ak_malloc_release_deferred()
+{
+#if AKMALLOC_ARENAS
+    for (ak_u32 i = 0; i < NARENAS; ++i) {
+        ak_malloc_state* m = *(ak_malloc_state* volatile*)ak_as_ptr(ARENAS[i]);
+        if (m) {
+            ak_malloc_release_deferred_in_state(m);
         }
     }
+#else
+    ak_malloc_release_deferred_in_state(GMSTATE);
+#endif
+}
 
-    {// mmaped chunks
-        ak_circ_list_for_each(ak_ca_segment, seg, &(m->map_root)) {
-            if (!cbk(seg, seg->sz)) {
-                return;
-            }
+AK_THREAD_ROUTINE(ak_maintenance_main)
+{
+    const ak_u32 generation = (ak_u32)(ak_sz)arg;
+    // sleep in short slices so that stopping does not wait a whole interval
+    static const ak_u32 SLICE_MS = 10;
+    ak_u32 slept = 0;
+    while (*(volatile ak_u32*)ak_as_ptr(AK_MAINTENANCE.generation) == generation) {
+        ak_os_sleep(SLICE_MS * 1000);
+        ak_async_free_drain();
+        slept += SLICE_MS;
+        if (slept >= AK_MAINTENANCE.interval) {
+            slept = 0;
+            ak_malloc_release_deferred();
         }
     }
+    AK_THREAD_ROUTINE_RETURN;
 }
-/********************** mallocstate end ************************/
 
-/***********************************************
- * Exported APIs
- ***********************************************/
+static void ak_malloc_set_defer_release(int defer)
+{
+    *(volatile ak_u32*)ak_as_ptr(MALLOC_DEFER_RELEASE) = defer ? 1 : 0;
+#if AKMALLOC_ARENAS
+    ak_spinlock_acquire(ak_as_ptr(ARENA_LOCK));
+    for (ak_u32 i = 0; i < NARENAS; ++i) {
+        if (ARENAS[i]) {
+            ak_malloc_state_defer_release(ARENAS[i], defer);
+        }
+    }
+    ak_spinlock_release(ak_as_ptr(ARENA_LOCK));
+#else
+    ak_malloc_state_defer_release(GMSTATE, defer);
+#endif
+}
 
-static int MALLOC_INIT = 0;
+#endif/*defined(AK_MALLOCSTATE_USE_LOCKS)*/
+/********************** maintenance end ************************/
 
-static ak_malloc_state MALLOC_ROOT;
-static ak_malloc_state* GMSTATE = AK_NULLPTR;
-static ak_spinlock MALLOC_INIT_LOCK = { 0 };
+#if AKMALLOC_THREAD_CACHE
+#  define ak_malloc_init_thread_cache() ak_tcache_init_global()
+#elif AKMALLOC_CPU_CACHE
+#  define ak_malloc_init_thread_cache() ak_cpucache_init_global()
+#else
+#  define ak_malloc_init_thread_cache()
+#endif
 
 #define ak_ensure_malloc_state_init()                        \
 {                                                            \
@@ -3015,6 +6236,9 @@ static ak_spinlock MALLOC_INIT_LOCK = { 0 };
         if (MALLOC_INIT != 1) {                              \
             GMSTATE = &MALLOC_ROOT;                          \
             ak_malloc_init_state(GMSTATE);                   \
+            ak_malloc_init_arenas();                         \
+            ak_malloc_init_thread_cache();                   \
+            ak_epoch_init_global();                          \
             MALLOC_INIT = 1;                                 \
         }                                                    \
         AKMALLOC_LOCK_RELEASE(ak_as_ptr(MALLOC_INIT_LOCK));  \
@@ -3027,38 +6251,66 @@ AK_EXTERN_C_BEGIN
 void* ak_malloc(size_t sz)
 {
     ak_ensure_malloc_state_init();
-    return ak_malloc_from_state(GMSTATE, sz);
+    ak_malloc_state* m = ak_malloc_thread_state();
+#if AKMALLOC_THREAD_CACHE
+    void* mem = ak_tcache_alloc(m, sz);
+    if (ak_likely(mem)) {
+        return mem;
+    }
+#elif AKMALLOC_CPU_CACHE
+    void* mem = ak_cpucache_alloc(m, sz);
+    if (ak_likely(mem)) {
+        return mem;
+    }
+#endif
+    return ak_malloc_from_state(m, sz);
 }
 
 void* ak_calloc(size_t elsz, size_t numel)
 {
     const ak_sz sz = elsz*numel;
-    void* mem = ak_malloc_from_state(GMSTATE, sz);
-    return ak_memset(mem, 0, sz);
+    // goes through the thread cache like any other allocation
+    void* mem = ak_malloc(sz);
+    return ak_likely(mem) ? ak_memset(mem, 0, sz) : mem;
 }
 
 void ak_free(void* mem)
 {
     ak_ensure_malloc_state_init();
+#if AKMALLOC_ASYNC_FREE
+    if (ak_unlikely(AK_ASYNC_FREE_MODE) && ak_likely(mem)) {
+        ak_async_free_push(mem);
+        return;
+    }
+#endif
+#if AKMALLOC_THREAD_CACHE
+    if (ak_likely(mem) && ak_alloc_is_slab(mem) && ak_tcache_free(ak_malloc_thread_state(), mem)) {
+        return;
+    }
+#elif AKMALLOC_CPU_CACHE
+    if (ak_likely(mem) && ak_alloc_is_slab(mem) && ak_cpucache_free(ak_malloc_thread_state(), mem)) {
+        return;
+    }
+#endif
     ak_free_to_state(GMSTATE, mem);
 }
 
 void* ak_aligned_alloc(size_t sz, size_t aln)
 {
     ak_ensure_malloc_state_init();
-    return ak_aligned_alloc_from_state(GMSTATE, sz, aln);
+    return ak_aligned_alloc_from_state(ak_malloc_thread_state(), sz, aln);
 }
 
 int ak_posix_memalign(void** pmem, size_t aln, size_t sz)
 {
     ak_ensure_malloc_state_init();
-    return ak_posix_memalign_from_state(GMSTATE, pmem, aln, sz);
+    return ak_posix_memalign_from_state(ak_malloc_thread_state(), pmem, aln, sz);
 }
 
 void* ak_memalign(size_t sz, size_t aln)
 {
     ak_ensure_malloc_state_init();
-    return ak_aligned_alloc_from_state(GMSTATE, sz, aln);
+    return ak_aligned_alloc_from_state(ak_malloc_thread_state(), sz, aln);
 }
 
 size_t ak_malloc_usable_size(const void* mem)
@@ -3069,19 +6321,152 @@ size_t ak_malloc_usable_size(const void* mem)
 void* ak_realloc(void* mem, size_t newsz)
 {
     ak_ensure_malloc_state_init();
-    return ak_realloc_from_state(GMSTATE, mem, newsz);
+    return ak_realloc_from_state(ak_malloc_thread_state(), mem, newsz);
 }
 
 void* ak_realloc_in_place(void* mem, size_t newsz)
 {
     ak_ensure_malloc_state_init();
-    return ak_realloc_in_place_from_state(GMSTATE, mem, newsz);
+    return ak_realloc_in_place_from_state(ak_malloc_thread_state(), mem, newsz);
+}
+
+size_t ak_malloc_batch(size_t sz, size_t n, void** out)
+{
+    ak_ensure_malloc_state_init();
+    return ak_malloc_batch_from_state(ak_malloc_thread_state(), sz, n, out);
+}
+
+void ak_free_batch(void** p, size_t n)
+{
+    ak_ensure_malloc_state_init();
+    ak_free_batch_to_state(GMSTATE, p, n);
+}
+
+void ak_free_async(void* mem)
+{
+    ak_ensure_malloc_state_init();
+#if AKMALLOC_ASYNC_FREE
+    if (ak_likely(mem)) {
+        ak_async_free_push(mem);
+    }
+#else
+    ak_free(mem);
+#endif
+}
+
+void ak_malloc_set_async_free(int on)
+{
+#if AKMALLOC_ASYNC_FREE
+    AK_ASYNC_FREE_MODE = on ? 1 : 0;
+#else
+    (void)on;
+#endif
+}
+
+void ak_malloc_drain_async_frees()
+{
+    ak_ensure_malloc_state_init();
+    ak_async_free_drain();
+}
+
+int ak_epoch_enter()
+{
+    ak_ensure_malloc_state_init();
+    return ak_epoch_enter_critical() ? 0 : -1;
+}
+
+void ak_epoch_exit()
+{
+    ak_epoch_exit_critical();
+}
+
+void ak_free_deferred(void* mem)
+{
+    ak_ensure_malloc_state_init();
+    if (ak_likely(mem)) {
+        ak_epoch_retire(mem);
+    }
+}
+
+int ak_malloc_start_maintenance(unsigned int interval_ms)
+{
+    ak_ensure_malloc_state_init();
+#if defined(AK_MALLOCSTATE_USE_LOCKS)
+    int ok = 1;
+    ak_spinlock_acquire(ak_as_ptr(AK_MAINTENANCE.LOCKED));
+    if (!AK_MAINTENANCE.running) {
+        AK_MAINTENANCE.interval = (interval_ms > 0) ? (ak_u32)interval_ms : 1;
+        const ak_u32 generation = ++(AK_MAINTENANCE.generation);
+        ak_malloc_set_defer_release(1);
+        ok = ak_thread_start(ak_as_ptr(AK_MAINTENANCE.thread), ak_maintenance_main, (void*)(ak_sz)generation);
+        if (ak_likely(ok)) {
+            AK_MAINTENANCE.running = 1;
+        } else {
+            ak_malloc_set_defer_release(0);
+        }
+    }
+    ak_spinlock_release(ak_as_ptr(AK_MAINTENANCE.LOCKED));
+    return ok ? 0 : -1;
+#else
+    (void)interval_ms;
+    return -1;
+#endif
+}
+
+void ak_malloc_stop_maintenance()
+{
+#if defined(AK_MALLOCSTATE_USE_LOCKS)
+    // the thread may take a whole pass to notice, so it is joined after releasing the lock, and
+    // a start in the meantime runs a new thread under a new generation
+    ak_spinlock_acquire(ak_as_ptr(AK_MAINTENANCE.LOCKED));
+    const int running = AK_MAINTENANCE.running;
+    const ak_thread thread = AK_MAINTENANCE.thread;
+    if (running) {
+        ++*(volatile ak_u32*)ak_as_ptr(AK_MAINTENANCE.generation);
+        AK_MAINTENANCE.running = 0;
+        ak_malloc_set_defer_release(0);
+    }
+    ak_spinlock_release(ak_as_ptr(AK_MAINTENANCE.LOCKED));
+
+    if (running) {
+        ak_thread_join(thread);
+        // whatever was queued or became due since the last pass
+        ak_async_free_drain();
+        ak_malloc_release_deferred();
+    }
+#endif
+}
+
+void ak_malloc_get_stats(ak_malloc_stats* st)
+{
+    ak_ensure_malloc_state_init();
+    ak_memset(st, 0, sizeof(ak_malloc_stats));
+#if AKMALLOC_ARENAS
+    for (ak_u32 i = 0; i < NARENAS; ++i) {
+        ak_malloc_state* m = *(ak_malloc_state* volatile*)ak_as_ptr(ARENAS[i]);
+        if (m) {
+            ak_malloc_add_stats_in_state(m, st);
+        }
+    }
+#else
+    ak_malloc_add_stats_in_state(GMSTATE, st);
+#endif
+    st->async_free_backlog = ak_async_free_backlog();
 }
 
 void ak_malloc_for_each_segment(ak_seg_cbk cbk)
 {
     ak_ensure_malloc_state_init();
+#if AKMALLOC_ARENAS
+    for (ak_u32 i = 0; i < NARENAS; ++i) {
+        ak_malloc_state* m = *(ak_malloc_state* volatile*)ak_as_ptr(ARENAS[i]);
+        if (m && !ak_malloc_for_each_segment_in_state(m, cbk)) {
+            return;
+        }
+    }
+#else
     ak_malloc_for_each_segment_in_state(GMSTATE, cbk);
+#endif
 }
 
 AK_EXTERN_C_END
@@ -45,6 +45,17 @@ For more information, please refer to <http://unlicense.org/>
 #  define ak_memalign                 memalign
 #  define ak_realloc                  realloc
 #  define ak_malloc_usable_size       malloc_usable_size
+#  define ak_malloc_batch             malloc_batch
+#  define ak_free_batch               malloc_free_batch
+#  define ak_free_async               malloc_free_async
+#  define ak_malloc_set_async_free    malloc_set_async_free
+#  define ak_malloc_drain_async_frees malloc_drain_async_frees
+#  define ak_epoch_enter              malloc_epoch_enter
+#  define ak_epoch_exit               malloc_epoch_exit
+#  define ak_free_deferred            malloc_free_deferred
+#  define ak_malloc_start_maintenance malloc_start_maintenance
+#  define ak_malloc_stop_maintenance  malloc_stop_maintenance
+#  define ak_malloc_get_stats         malloc_get_stats
 #  define ak_malloc_for_each_segment  malloc_for_each_segment
 #endif
 
@@ -62,6 +73,16 @@ For more information, please refer to <http://unlicense.org/>
 typedef int(*ak_seg_cbk)(const void* p, size_t sz);
 #define AK_SEG_CBK_DEFINED
 
+/**
+ * Allocator statistics.
+ */
+typedef struct ak_malloc_stats_tag
+{
+    size_t slab_spills;        /**< small allocations served by a larger slab size because of contention */
+    size_t async_free_backlog; /**< frees queued by ak_free_async() and not yet performed */
+} ak_malloc_stats;
+#define AK_MALLOC_STATS_DEFINED
+
 #if defined(__cplusplus)
 #  define AK_EXTERN_C_BEGIN extern "C"  {
 #  define AK_EXTERN_C_END   }/*extern C*/
@@ -149,6 +170,90 @@ AKMALLOC_EXPORT void*  ak_aligned_alloc(size_t aln, size_t sz);
  */
 AKMALLOC_EXPORT int    ak_posix_memalign(void** pptr, size_t aln, size_t sz);
 
+/*!
+ * Attempt to allocate \p n blocks of memory containing at least \p sz bytes each. Small sizes
+ * take the allocator lock once for the whole batch.
+ * \param sz; The size for each allocation
+ * \param n; Number of allocations
+ * \param out; Array of at least \p n pointers that receives the allocated memory
+ *
+ * \return The number of pointers written to \p out, less than \p n if no more memory is
+ * available.
+ */
+AKMALLOC_EXPORT size_t ak_malloc_batch(size_t sz, size_t n, void** out);
+
+/*!
+ * Return several blocks of memory to the allocator. Consecutive blocks owned by the same
+ * allocator are returned under one acquisition of its lock, so keeping blocks of the same size
+ * and age together in \p p makes this cheaper.
+ * \param p; Array of pointers to the memory to return, \c NULL entries are skipped
+ * \param n; Number of pointers in \p p
+ */
+AKMALLOC_EXPORT void   ak_free_batch(void** p, size_t n);
+
+/*!
+ * Queue memory to be freed by another thread. The memory is freed by the maintenance thread, or by
+ * the next call to \c ak_malloc_drain_async_frees().
+ * \param p; The memory to free
+ */
+AKMALLOC_EXPORT void   ak_free_async(void* p);
+
+/*!
+ * Make \c free() on the calling thread behave like \c ak_free_async().
+ * \param on; Non-zero to queue frees, \c 0 to free inline again
+ */
+AKMALLOC_EXPORT void   ak_malloc_set_async_free(int on);
+
+/*!
+ * Free all memory queued so far by \c ak_free_async() or asynchronous \c free() on any thread.
+ * The queue is shared by all threads and the frees are performed on the calling thread.
+ */
+AKMALLOC_EXPORT void   ak_malloc_drain_async_frees(void);
+
+/*!
+ * Enter a critical section for reading a lock-free data structure. Memory retired with
+ * \c ak_free_deferred() stays valid until every critical section that could have seen it has been
+ * left. Critical sections may be nested.
+ *
+ * \return \c 0 on success, non-zero if the OS is out of memory. \c ak_epoch_exit() must only be
+ * called after a successful enter.
+ */
+AKMALLOC_EXPORT int    ak_epoch_enter(void);
+
+/*!
+ * Leave a critical section entered with \c ak_epoch_enter().
+ */
+AKMALLOC_EXPORT void   ak_epoch_exit(void);
+
+/*!
+ * Free memory once no thread is inside a critical section that could still read it.
+ * \param p; The memory to free, it must already be unreachable for new readers
+ */
+AKMALLOC_EXPORT void   ak_free_deferred(void* p);
+
+/*!
+ * Start a thread that returns free memory to the OS in the background. While it runs, \c free()
+ * leaves empty slab pages and coalescing allocator segments to it instead of releasing them
+ * inline. Allocations too large for those, which are mapped on their own, are still unmapped by
+ * \c free(). Calling this again while the thread runs does nothing. Requires a thread safe build.
+ * \param interval_ms; Time between two passes of the thread, in milliseconds
+ *
+ * \return \c 0 on success, non-zero if the thread could not be started.
+ */
+AKMALLOC_EXPORT int    ak_malloc_start_maintenance(unsigned int interval_ms);
+
+/*!
+ * Stop the thread started by \c ak_malloc_start_maintenance() and wait for it to exit. Memory is
+ * released inline by \c free() again afterwards.
+ */
+AKMALLOC_EXPORT void   ak_malloc_stop_maintenance(void);
+
+/*!
+ * Get the allocator statistics.
+ * \param st; Filled with the statistics summed over all arenas
+ */
+AKMALLOC_EXPORT void   ak_malloc_get_stats(ak_malloc_stats* st);
+
 /*!
  * Iterate over all memory segments allocated.
  * \param cbk; Callback that is given the address of a segment and its size. \see ak_seg_cbk.
@@ -0,0 +1,181 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file epoch_retire.c
+ * \date Oct 17, 2026
+ *
+ * Test for \c ak_free_deferred() while another thread is pinned on an older epoch. Build and run
+ * (POSIX only):
+ *
+ *     cc -O2 -DAKMALLOC_INCLUDE_ONLY -Iinclude test/epoch_retire.c -o epoch_retire -lpthread
+ *     ./epoch_retire
+ *
+ * The first part pins a reader, lets the global epoch move past the reader's epoch, and then
+ * retires an object together with enough others to fill several bags. The object must stay in a
+ * bag of the retiring thread until the reader leaves. The second part has a writer replace and
+ * retire a published object in a loop while a reader checks that the object it holds does not
+ * change under it, which it would if the object were freed and handed out again.
+ * Prints "ok" and exits with 0 on success.
+ */
+
+#include "akmalloc/malloc.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EPOCH_TEST_CHECK(c)                                                     \
+    if (!(c)) {                                                                 \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);  \
+        exit(1);                                                                \
+    }
+
+typedef struct epoch_obj_tag epoch_obj;
+
+struct epoch_obj_tag
+{
+    volatile long v;
+    char          pad[56];
+};
+
+static volatile int PINNED = 0;
+static volatile int UNPIN = 0;
+
+static void* epoch_pinned_reader(void* arg)
+{
+    (void)arg;
+    EPOCH_TEST_CHECK(ak_epoch_enter() == 0);
+    PINNED = 1;
+    while (!UNPIN) {
+        sched_yield();
+    }
+    ak_epoch_exit();
+    return AK_NULLPTR;
+}
+
+static int epoch_is_retired(void* mem)
+{
+    for (ak_epoch_bag* b = AK_EPOCH_REC->bags; b; b = b->next) {
+        for (ak_u32 i = 0; i < b->n; ++i) {
+            if (b->objs[i] == mem) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void epoch_retire_many(int n)
+{
+    for (int i = 0; i < n; ++i) {
+        ak_free_deferred(ak_malloc(sizeof(epoch_obj)));
+    }
+}
+
+static void epoch_test_pinned()
+{
+    pthread_t t;
+    EPOCH_TEST_CHECK(pthread_create(&t, AK_NULLPTR, epoch_pinned_reader, AK_NULLPTR) == 0);
+    while (!PINNED) {
+        sched_yield();
+    }
+    // the reader observed the current epoch, so the epoch can advance once past it
+    const ak_u32 pinned = ak_epoch_now();
+    ak_epoch_try_advance();
+    EPOCH_TEST_CHECK(ak_epoch_now() == ((pinned + 1) & AK_EPOCH_MASK));
+
+    epoch_obj* o = (epoch_obj*)ak_malloc(sizeof(epoch_obj));
+    ak_free_deferred(o);
+    epoch_retire_many(8 * AK_EPOCH_BAG_SIZE);
+    EPOCH_TEST_CHECK(ak_epoch_now() == ((pinned + 1) & AK_EPOCH_MASK));
+    EPOCH_TEST_CHECK(epoch_is_retired(o));
+
+    UNPIN = 1;
+    EPOCH_TEST_CHECK(pthread_join(t, AK_NULLPTR) == 0);
+    // retiring more objects here could retire o again once it is freed and reused
+    ak_epoch_try_advance();
+    ak_epoch_try_advance();
+    ak_epoch_reclaim(AK_EPOCH_REC);
+    EPOCH_TEST_CHECK(!epoch_is_retired(o));
+}
+
+static epoch_obj* volatile PUBLISHED = AK_NULLPTR;
+static volatile int DONE = 0;
+static volatile long READS = 0;
+
+static void* epoch_checking_reader(void* arg)
+{
+    (void)arg;
+    while (!DONE) {
+        EPOCH_TEST_CHECK(ak_epoch_enter() == 0);
+        epoch_obj* o = PUBLISHED;
+        const long v = o->v;
+        for (int i = 0; i < 100; ++i) {
+            EPOCH_TEST_CHECK(o->v == v);
+        }
+        sched_yield();
+        EPOCH_TEST_CHECK(o->v == v);
+        ak_epoch_exit();
+        READS = READS + 1;
+    }
+    return AK_NULLPTR;
+}
+
+static void epoch_test_replace(long rounds)
+{
+    epoch_obj* o = (epoch_obj*)ak_malloc(sizeof(epoch_obj));
+    o->v = 0;
+    PUBLISHED = o;
+    pthread_t t;
+    EPOCH_TEST_CHECK(pthread_create(&t, AK_NULLPTR, epoch_checking_reader, AK_NULLPTR) == 0);
+    for (long i = 1; i <= rounds; ++i) {
+        epoch_obj* n = (epoch_obj*)ak_malloc(sizeof(epoch_obj));
+        n->v = i;
+        epoch_obj* old = PUBLISHED;
+        PUBLISHED = n;
+        ak_free_deferred(old);
+        if ((i % 1024) == 0) {
+            sched_yield();
+        }
+    }
+    DONE = 1;
+    EPOCH_TEST_CHECK(pthread_join(t, AK_NULLPTR) == 0);
+    EPOCH_TEST_CHECK(READS > 0);
+}
+
+int main(int argc, char** argv)
+{
+    const long rounds = (argc > 1) ? atol(argv[1]) : 2000000;
+    ak_free(ak_malloc(1));
+    // the retiring thread needs its record before the test looks into it
+    ak_free_deferred(ak_malloc(sizeof(epoch_obj)));
+    epoch_test_pinned();
+    epoch_test_replace(rounds);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file numa_remote_free.c
+ * \date Oct 17, 2026
+ *
+ * Test for memory allocated on one NUMA node and freed on another. Two nodes are pretended, so
+ * the test runs on any Linux machine. Build and run:
+ *
+ *     cc -O1 -DAKMALLOC_INCLUDE_ONLY -DAKMALLOC_NUMA=1 -DAKMALLOC_NUMA_NODES=2 -Iinclude \
+ *        test/numa_remote_free.c -o numa_remote_free -lpthread
+ *     ./numa_remote_free
+ *
+ * The main thread is bound to node 0 and a second thread to node 1. Each allocates slab, span,
+ * coalesced and mmap-ed memory that the other thread frees. Slab objects must go back to the
+ * page they came from, and not into the cache of the freeing thread. Then both threads allocate
+ * again from their own arena.
+ *
+ * With \c AKMALLOC_CPU_CACHE both pretended nodes share the magazines of the one CPU they run on,
+ * so objects move between their arenas through the cache. The test then only checks that the
+ * CPU cache refuses an object of the other arena. Prints "ok" and exits with 0 on success.
+ */
+
+#if !defined(AKMALLOC_NUMA)
+#  define AKMALLOC_NUMA 1
+#endif
+
+#if !defined(AKMALLOC_NUMA_NODES)
+#  define AKMALLOC_NUMA_NODES 2
+#endif
+
+#include "akmalloc/malloc.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUMA_TEST_CHECK(c)                                                      \
+    if (!(c)) {                                                                 \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);  \
+        exit(1);                                                                \
+    }
+
+#define NUMA_TEST_NSIZES 5
+
+static const size_t NUMA_TEST_SIZES[NUMA_TEST_NSIZES] = { 64, 200, 4000, 40000, 1 << 20 };
+
+typedef struct numa_side_tag numa_side;
+
+struct numa_side_tag
+{
+    ak_malloc_state* arena;
+    void*            mem[NUMA_TEST_NSIZES];
+};
+
+static numa_side SIDES[2];
+
+static ak_u32 numa_arena_index(ak_malloc_state* m)
+{
+    for (ak_u32 i = 0; i < NARENAS; ++i) {
+        if (ARENAS[i] == m) {
+            return i;
+        }
+    }
+    NUMA_TEST_CHECK(0);
+    return 0;
+}
+
+static void numa_alloc_side(numa_side* side)
+{
+    for (int i = 0; i < NUMA_TEST_NSIZES; ++i) {
+        side->mem[i] = ak_malloc(NUMA_TEST_SIZES[i]);
+        NUMA_TEST_CHECK(side->mem[i]);
+        ak_memset(side->mem[i], 0x5A, NUMA_TEST_SIZES[i]);
+    }
+    side->arena = AK_ARENA;
+    NUMA_TEST_CHECK(side->arena);
+}
+
+/*!
+ * Free the memory of the other side. Slab objects must come back to their page right away.
+ */
+static void numa_free_side(numa_side* side)
+{
+    for (int i = 0; i < NUMA_TEST_NSIZES; ++i) {
+        void* mem = side->mem[i];
+        if (!AKMALLOC_CPU_CACHE && ak_alloc_is_slab(mem)) {
+            ak_slab* slab = ak_slab_of(ak_slab_mem_2_alloc(mem));
+            const ak_slab_root* root = slab->root;
+            NUMA_TEST_CHECK(((ak_sz)root >= (ak_sz)(side->arena)) &&
+                            ((ak_sz)root < (ak_sz)(side->arena + 1)));
+            const ak_u32 nfree = slab->nfree;
+            ak_free(mem);
+            NUMA_TEST_CHECK(slab->nfree == nfree + 1);
+        } else {
+            ak_free(mem);
+        }
+        side->mem[i] = AK_NULLPTR;
+    }
+}
+
+static void* numa_other_node(void* arg)
+{
+    (void)arg;
+    numa_alloc_side(ak_as_ptr(SIDES[1]));
+    numa_free_side(ak_as_ptr(SIDES[0]));
+    return AK_NULLPTR;
+}
+
+#if AKMALLOC_CPU_CACHE
+static void numa_cpucache_refuses_other_arena()
+{
+    void* mem = ak_malloc(NUMA_TEST_SIZES[0]);
+    NUMA_TEST_CHECK(mem && ak_alloc_is_slab(mem));
+    const ak_slab_root* root = ak_slab_of(ak_slab_mem_2_alloc(mem))->root;
+    const int in0 = ((ak_sz)root >= (ak_sz)(SIDES[0].arena)) && ((ak_sz)root < (ak_sz)(SIDES[0].arena + 1));
+    ak_malloc_state* other = in0 ? SIDES[1].arena : SIDES[0].arena;
+    NUMA_TEST_CHECK(!ak_cpucache_free(other, mem));
+    ak_free(mem);
+}
+#endif
+
+int main()
+{
+    // the test relies on the two nodes it was built with
+    unsetenv("AKMALLOC_NUMA_NODES");
+    numa_alloc_side(ak_as_ptr(SIDES[0]));
+    NUMA_TEST_CHECK(NUMA_NODES == 2);
+
+    pthread_t t;
+    NUMA_TEST_CHECK(pthread_create(&t, AK_NULLPTR, numa_other_node, AK_NULLPTR) == 0);
+    NUMA_TEST_CHECK(pthread_join(t, AK_NULLPTR) == 0);
+
+    // arena i belongs to node i % NUMA_NODES, nodes are handed out round robin
+    NUMA_TEST_CHECK((numa_arena_index(SIDES[0].arena) % 2) == 0);
+    NUMA_TEST_CHECK((numa_arena_index(SIDES[1].arena) % 2) == 1);
+
+    numa_free_side(ak_as_ptr(SIDES[1]));
+#if AKMALLOC_CPU_CACHE
+    numa_cpucache_refuses_other_arena();
+#endif
+    for (int i = 0; i < NUMA_TEST_NSIZES; ++i) {
+        void* mem = ak_malloc(NUMA_TEST_SIZES[i]);
+        NUMA_TEST_CHECK(mem);
+        ak_free(mem);
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_reclaim.c
+ * \date Oct 17, 2026
+ *
+ * Test for \c ak_try_reclaim_memory() running while other threads allocate and free. Reclaim
+ * normally runs only when an allocation fails, here one thread calls it in a loop while four
+ * threads allocate and free random sizes up to 3KB, which covers the page and span slab roots
+ * and the smallest coalescing allocators. Build and run (POSIX only):
+ *
+ *     cc -O1 -DAKMALLOC_INCLUDE_ONLY -DAKMALLOC_THREAD_CACHE=0 -Iinclude test/slab_reclaim.c \
+ *        -o slab_reclaim -lpthread
+ *     ./slab_reclaim [ops per thread]
+ *
+ * Without a thread cache every call reaches the roots. A root that is reclaimed without its lock
+ * trips an assertion of the slab allocator. Prints "ok" and exits with 0 on success.
+ */
+
+#include "akmalloc/malloc.c"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RECLAIM_THREADS 4
+#define RECLAIM_SLOTS 512
+
+static volatile int RECLAIM_DONE = 0;
+static long RECLAIM_OPS = 0;
+
+static void* reclaim_churn(void* arg)
+{
+    unsigned seed = 12345u + (unsigned)(size_t)arg;
+    void* slots[RECLAIM_SLOTS] = { 0 };
+    for (long i = 0; i < RECLAIM_OPS; ++i) {
+        seed = (seed * 1103515245u) + 12345u;
+        const unsigned r = seed >> 8;
+        const unsigned k = r % RECLAIM_SLOTS;
+        if (slots[k]) {
+            ak_free(slots[k]);
+            slots[k] = AK_NULLPTR;
+        } else {
+            slots[k] = ak_malloc(16 + (r >> 9) % 3000);
+        }
+    }
+    for (int k = 0; k < RECLAIM_SLOTS; ++k) {
+        ak_free(slots[k]);
+    }
+    return AK_NULLPTR;
+}
+
+static void* reclaim_loop(void* arg)
+{
+    (void)arg;
+    while (!RECLAIM_DONE) {
+        ak_try_reclaim_memory(GMSTATE);
+        sched_yield();
+    }
+    return AK_NULLPTR;
+}
+
+int main(int argc, char** argv)
+{
+    RECLAIM_OPS = (argc > 1) ? atol(argv[1]) : 3000000;
+    ak_free(ak_malloc(1));
+    pthread_t reclaimer;
+    pthread_t churners[RECLAIM_THREADS];
+    if (pthread_create(&reclaimer, AK_NULLPTR, reclaim_loop, AK_NULLPTR) != 0) {
+        return 1;
+    }
+    for (int i = 0; i < RECLAIM_THREADS; ++i) {
+        if (pthread_create(&churners[i], AK_NULLPTR, reclaim_churn, (void*)(size_t)i) != 0) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < RECLAIM_THREADS; ++i) {
+        pthread_join(churners[i], AK_NULLPTR);
+    }
+    RECLAIM_DONE = 1;
+    pthread_join(reclaimer, AK_NULLPTR);
+    printf("ok\n");
+    return 0;
+}
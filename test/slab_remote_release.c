@@ -0,0 +1,116 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_remote_release.c
+ * \date Oct 17, 2026
+ *
+ * Test that returning memory to the OS counts the pages emptied by remote frees. Objects freed
+ * while another thread holds the slab lock are queued on their page and merged by the next lock
+ * holder. The test empties whole pages through that queue only, then checks that a deferred
+ * release pass, as run by the maintenance thread, and a reclaim pass both merge the queue and
+ * return the pages. Build and run:
+ *
+ *     cc -O1 -DAKMALLOC_INCLUDE_ONLY -DAKMALLOC_THREAD_CACHE=0 -Iinclude \
+ *        test/slab_remote_release.c -o slab_remote_release -lpthread
+ *     ./slab_remote_release
+ *
+ * Prints "ok" and exits with 0 on success.
+ */
+
+#include "akmalloc/malloc.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REMOTE_TEST_CHECK(c)                                                    \
+    if (!(c)) {                                                                 \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);  \
+        exit(1);                                                                \
+    }
+
+#if !defined(AK_SLAB_LOCKFREE)
+/*!
+ * Allocate \p npages full pages from \p root, and free every object through the remote queue.
+ */
+static void remote_free_pages(ak_slab_root* root, void** objs, ak_u32 npages)
+{
+    const ak_u32 n = npages * root->navail;
+    for (ak_u32 i = 0; i < n; ++i) {
+        objs[i] = ak_slab_alloc(root);
+        REMOTE_TEST_CHECK(objs[i]);
+    }
+    const ak_u32 nempty = root->nempty;
+    for (ak_u32 i = 0; i < n; ++i) {
+        ak_slab_free_remote(root, objs[i]);
+    }
+    REMOTE_TEST_CHECK(root->REMOTE);
+    REMOTE_TEST_CHECK(root->nempty == nempty);
+}
+
+static void remote_test_deferred_release()
+{
+    static void* objs[64 * (AKMALLOC_DEFAULT_PAGE_SIZE / 16)];
+    ak_slab_root root;
+    ak_slab_init_root_default(&root, 64);
+    root.DEFER_RELEASE = 1;
+    const ak_u32 npages = root.RELEASE_RATE + 4;
+    REMOTE_TEST_CHECK(npages * root.navail <= sizeof(objs) / sizeof(objs[0]));
+    remote_free_pages(&root, objs, npages);
+
+    ak_slab_release_os_mem(&root);
+    REMOTE_TEST_CHECK(!root.REMOTE);
+    REMOTE_TEST_CHECK(root.release == 0);
+    const ak_u32 nfreed = (npages < root.MAX_PAGES_TO_FREE) ? npages : root.MAX_PAGES_TO_FREE;
+    REMOTE_TEST_CHECK(root.nempty == npages - nfreed);
+    ak_slab_destroy(&root);
+}
+
+static void remote_test_reclaim()
+{
+    static void* objs[64 * (AKMALLOC_DEFAULT_PAGE_SIZE / 16)];
+    void* p = ak_malloc(64);
+    REMOTE_TEST_CHECK(p && ak_alloc_is_slab(p));
+    ak_slab_root* root = ak_slab_of(ak_slab_mem_2_alloc(p))->root;
+    ak_free(p);
+    remote_free_pages(root, objs, 16);
+
+    ak_try_reclaim_memory(GMSTATE);
+    REMOTE_TEST_CHECK(!root->REMOTE);
+    REMOTE_TEST_CHECK(root->nempty == 0);
+}
+#endif
+
+int main()
+{
+#if !defined(AK_SLAB_LOCKFREE)
+    remote_test_deferred_release();
+    remote_test_reclaim();
+#endif
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/**
+ * \file slab_spillover.c
+ * \date Oct 17, 2026
+ *
+ * Test for \c AKMALLOC_SLAB_SPILLOVER, which the test enables unless the build turns it off. The
+ * test holds the lock of a small slab size while another thread allocates that size. Build it
+ * without and with the thread cache (POSIX only):
+ *
+ *     cc -O1 -DAKMALLOC_INCLUDE_ONLY -DAKMALLOC_THREAD_CACHE=0 -Iinclude \
+ *        test/slab_spillover.c -o slab_spillover -lpthread
+ *     cc -O1 -DAKMALLOC_INCLUDE_ONLY -Iinclude test/slab_spillover.c -o slab_spillover_tc -lpthread
+ *
+ * Without a thread or CPU cache the allocation must come from a larger slab size and be counted
+ * in \c ak_malloc_stats::slab_spills. With a cache, the cache refills from its own size and waits
+ * for the lock, so the allocation must come from the held size and nothing is counted.
+ * Prints "ok" and exits with 0 on success.
+ */
+
+#if !defined(AKMALLOC_SLAB_SPILLOVER)
+#  define AKMALLOC_SLAB_SPILLOVER 1
+#endif
+
+#include "akmalloc/malloc.c"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SPILL_TEST_CHECK(c)                                                     \
+    if (!(c)) {                                                                 \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);  \
+        exit(1);                                                                \
+    }
+
+#define SPILL_TEST_SIZE 64
+
+#if !defined(AK_SLAB_LOCKFREE)
+static ak_slab_root* volatile SPILL_ROOT = AK_NULLPTR;
+static volatile int SPILL_LOCKED = 0;
+
+static ak_slab_root* spill_root_of(void* mem)
+{
+    SPILL_TEST_CHECK(mem && ak_alloc_is_slab(mem));
+    return ak_slab_of(ak_slab_mem_2_alloc(mem))->root;
+}
+
+/*!
+ * Find the root of the test size, then allocate that size again once the root is locked. Both
+ * allocations are made by this thread so that they come from the same arena.
+ */
+static void* spill_alloc(void* arg)
+{
+    (void)arg;
+    void* p = ak_malloc(SPILL_TEST_SIZE);
+    SPILL_ROOT = spill_root_of(p);
+    ak_free(p);
+    while (!SPILL_LOCKED) {
+        sched_yield();
+    }
+    return ak_malloc(SPILL_TEST_SIZE);
+}
+#endif
+
+int main()
+{
+#if !defined(AK_SLAB_LOCKFREE)
+    pthread_t t;
+    SPILL_TEST_CHECK(pthread_create(&t, AK_NULLPTR, spill_alloc, AK_NULLPTR) == 0);
+    while (!SPILL_ROOT) {
+        sched_yield();
+    }
+    ak_slab_root* root = SPILL_ROOT;
+    AK_SLAB_LOCK_ACQUIRE(root);
+    SPILL_LOCKED = 1;
+    // the allocating thread either spills while the lock is held, or waits for it
+    ak_os_sleep(20000);
+    AK_SLAB_LOCK_RELEASE(root);
+    void* q = AK_NULLPTR;
+    SPILL_TEST_CHECK(pthread_join(t, &q) == 0);
+
+    ak_malloc_stats st;
+    ak_malloc_get_stats(&st);
+#if AKMALLOC_SLAB_SPILLOVER && !AKMALLOC_THREAD_CACHE && !AKMALLOC_CPU_CACHE
+    SPILL_TEST_CHECK(spill_root_of(q)->sz > root->sz);
+    SPILL_TEST_CHECK(st.slab_spills == 1);
+#else
+    SPILL_TEST_CHECK(spill_root_of(q) == root);
+    SPILL_TEST_CHECK(st.slab_spills == 0);
+#endif
+    ak_free(q);
+#endif
+    printf("ok\n");
+    return 0;
+}